@@ -0,0 +1,29 @@
+// Link bonding header.
+// Stripes the data packets of one file over several links opened at the same time. Every data packet
+// carries the file offset of its chunk, so the receiver writes chunks in place in whatever order the
+// links deliver them. Each link is driven by its own thread and takes the next chunk as soon as it is
+// free, so the links share the file in proportion to their goodput.
+
+#ifndef _BONDING_H_
+#define _BONDING_H_
+
+#include "link_context.h"
+#include <stdio.h>
+
+// Most links one file can be striped over, the main one included.
+#define MAX_BOND_LINKS 8
+
+// Control value of a bonded data packet: C, 4 offset bytes (most significant first), L1, L2, data.
+#define BOND_DATA_PACKET 4
+#define BOND_HEADER_SIZE 7
+
+// Send the fileSize bytes of file over the count open links, then end each link with a one byte END packet.
+// Chunks fill the smallest frame agreed by any of the links.
+// Returns -1 on error.
+int bondSend(LinkContext **links, int count, FILE *file, int fileSize);
+
+// Receive fileSize bytes into file from the count open links, until each of them sends its END packet.
+// Returns -1 on error.
+int bondReceive(LinkContext **links, int count, FILE *file, int fileSize);
+
+#endif // _BONDING_H_
@@ -0,0 +1,40 @@
+// Link capabilities header.
+// The transmitter offers its link options as a block of TLVs (tag, length, value) carried in the
+// information field of the SET, the receiver answers with the options both ends will use in the UA.
+// The block is byte stuffed and protected by a CRC-16, whatever framing and check sequence get agreed.
+// A peer sending the plain 5-byte SET or UA takes no part, and each end keeps its own options.
+
+#ifndef _CAPABILITIES_H_
+#define _CAPABILITIES_H_
+
+#include "link_options.h"
+
+// TLV tags, unknown tags are skipped
+#define CAP_PAYLOAD_SIZE 1 // 2 bytes, most significant first
+#define CAP_WINDOW 2       // ARQ mode, window size
+#define CAP_FCS 3          // FcsType
+#define CAP_FRAMING 4      // FramingMode
+#define CAP_COMPRESSION 5  // CompressionMode
+#define CAP_FEC 6          // FecMode
+#define CAP_DUPLEX 7       // 1 for full duplex
+#define CAP_FLOW_CONTROL 8 // 1 if the end takes part in RNR flow control
+
+// Largest capability block, and the largest SET or UA carrying one.
+#define MAX_CAPABILITY_SIZE 32
+#define CAPABILITY_FCS FcsCrc16
+#define MAX_CAPABILITY_FRAME_SIZE (4 + 2 * (MAX_CAPABILITY_SIZE + MAX_FCS_SIZE) + 1)
+
+// Build a SET or UA with the given control field, carrying options.
+// Returns the size of the frame.
+int capabilityFrame(unsigned char control, const LinkOptions *options, unsigned char *frame);
+
+// Read the options in a capability block, with the defaults for tags that are missing.
+// Returns -1 if the block is malformed or holds values out of range.
+int capabilitiesRead(const unsigned char *data, int size, LinkOptions *options);
+
+// Options the receiver answers to an offer, own being its own: the frame size both ends can take,
+// the ARQ mode, window and framing asked for by the transmitter, the stronger check sequence and forward error
+// correction if either end wants it, and compression, full duplex and flow control if both do.
+void capabilitiesAgree(const LinkOptions *offer, const LinkOptions *own, LinkOptions *agreed);
+
+#endif // _CAPABILITIES_H_
@@ -0,0 +1,34 @@
+// Consistent Overhead Byte Stuffing header.
+// Alternative to FLAG/ESC stuffing for the I frame data field: COBS removes every zero byte at a cost of
+// one byte per 254, and XORing the result with FLAG turns "no zero" into "no FLAG" on the wire.
+// Worst case overhead is about 0.4%, instead of doubling for data full of FLAG and ESC bytes.
+
+#ifndef _COBS_H_
+#define _COBS_H_
+
+// Longest COBS block: a code byte followed by up to 254 data bytes.
+#define COBS_BLOCK_SIZE 254
+
+// Largest encoding of size bytes.
+#define COBS_MAX_SIZE(size) ((size) + (size) / COBS_BLOCK_SIZE + 1)
+
+typedef enum
+{
+    FramingStuffing, // FLAG and ESC are escaped with ESC, the default
+    FramingCobs,     // COBS, chosen by the transmitter in the SET/UA exchange
+} FramingMode;
+
+typedef struct
+{
+    unsigned char *out;
+    int size; // bytes written so far, including the code byte of the open block
+    int code; // index of the code byte of the open block
+} CobsEncoder;
+
+// Encode data given in several pieces into out, which must hold COBS_MAX_SIZE of the total:
+// cobsStart, then cobsUpdate for each piece, then cobsFinish, which returns the encoded size.
+void cobsStart(CobsEncoder *encoder, unsigned char *out);
+void cobsUpdate(CobsEncoder *encoder, const unsigned char *data, int size);
+int cobsFinish(CobsEncoder *encoder);
+
+#endif // _COBS_H_
@@ -0,0 +1,29 @@
+// Payload compression header.
+// A small LZ77 codec in the manner of LZ4, fast enough to run on every I frame: the compressed data is a
+// series of sequences, each a run of literal bytes followed by a copy of at least LZ_MIN_MATCH bytes
+// found earlier in the same payload. Text shrinks by about a third and logs by more, while data that is
+// already compressed, such as a GIF, does not shrink and is sent as it is.
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+typedef enum
+{
+    CompressionNone, // payloads are sent as they are, the default
+    CompressionLz,   // payloads that shrink are sent compressed with the codec below
+} CompressionMode;
+
+// Shortest copy a sequence refers to, and the largest data the codec takes.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_SIZE 65535
+
+// Compress size bytes of data, at most LZ_MAX_SIZE, into out, which holds capacity bytes.
+// Gives up as soon as the result would not fit, so a capacity below size only keeps data that shrinks.
+// Returns the compressed size, or -1 if it does not fit in capacity.
+int lzCompress(const unsigned char *data, int size, unsigned char *out, int capacity);
+
+// Decompress size bytes of data into out, which holds capacity bytes.
+// Returns the decompressed size, or -1 if the data is malformed or does not fit in capacity.
+int lzDecompress(const unsigned char *data, int size, unsigned char *out, int capacity);
+
+#endif // _COMPRESSION_H_
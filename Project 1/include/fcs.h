@@ -0,0 +1,37 @@
+// Frame check sequence header.
+
+#ifndef _FCS_H_
+#define _FCS_H_
+
+#include <stdint.h>
+
+typedef enum
+{
+    FcsXor,   // single XOR byte (BCC2), the default
+    FcsCrc16, // CRC-16-CCITT as used by HDLC (X.25)
+    FcsCrc32, // CRC-32 (IEEE 802.3)
+} FcsType;
+
+// Largest frame check sequence, in bytes.
+#define MAX_FCS_SIZE 4
+
+// Return the size in bytes of a frame check sequence of the given type.
+int fcsSize(FcsType type);
+
+// Compute the frame check sequence of size bytes of data.
+uint32_t fcsCompute(FcsType type, const unsigned char *data, int size);
+
+// Compute a frame check sequence over data given in several pieces:
+// fcsFinish(type, fcsUpdate(type, fcsStart(type), data, size)) equals fcsCompute(type, data, size).
+uint32_t fcsStart(FcsType type);
+uint32_t fcsUpdate(FcsType type, uint32_t fcs, const unsigned char *data, int size);
+uint32_t fcsFinish(FcsType type, uint32_t fcs);
+
+// Write fcs to out, least significant byte first.
+// Return the number of bytes written.
+int fcsWrite(FcsType type, uint32_t fcs, unsigned char *out);
+
+// Read a frame check sequence written by fcsWrite.
+uint32_t fcsRead(FcsType type, const unsigned char *in);
+
+#endif // _FCS_H_
@@ -0,0 +1,32 @@
+// Forward error correction header.
+// Reed-Solomon RS(255,223) over GF(256): every block of up to 223 data bytes gets 32 parity bytes and
+// any 16 wrong bytes in the block can be corrected, so the single bit errors of a noisy cable are fixed
+// by the receiver instead of costing a retransmission. Long data is split evenly into shortened blocks,
+// each one its data followed by its parity.
+
+#ifndef _FEC_H_
+#define _FEC_H_
+
+typedef enum
+{
+    FecNone,        // errors are only detected by the frame check sequence, the default
+    FecReedSolomon, // RS(255,223) over the payload and its frame check sequence
+} FecMode;
+
+#define FEC_DATA_SIZE 223
+#define FEC_PARITY_SIZE 32
+#define FEC_BLOCK_SIZE (FEC_DATA_SIZE + FEC_PARITY_SIZE)
+
+// Size of size bytes once encoded.
+#define FEC_ENCODED_SIZE(size) ((size) + FEC_PARITY_SIZE * (((size) + FEC_DATA_SIZE - 1) / FEC_DATA_SIZE))
+
+// Encode size bytes of data into out, which must hold FEC_ENCODED_SIZE(size) bytes.
+// Returns the encoded size.
+int fecEncode(const unsigned char *data, int size, unsigned char *out);
+
+// Correct size encoded bytes in place and move the data to the front, adding the number of
+// corrected bytes to *corrected.
+// Returns the data size, or -1 if a block has more errors than can be corrected.
+int fecDecode(unsigned char *data, int size, int *corrected);
+
+#endif // _FEC_H_
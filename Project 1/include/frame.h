@@ -0,0 +1,44 @@
+// Link layer frame format header.
+// Field values shared by the link layer and the frame decoder.
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include "fcs.h"
+#include "fec.h"
+#include "link_layer.h"
+
+#define FLAG 0x7E
+#define A_T 0x03
+#define A_R 0x01
+#define SET 0x03
+#define UA 0x07
+#define RR0 0xAA
+#define RR1 0xAB
+#define REJ0 0x54
+#define REJ1 0x55
+#define RNR0 0x34
+#define DISC 0x0B
+#define ESC 0x7D
+
+// set in the address of an I frame whose payload is compressed, see compression.h; with 0x80 instead, the
+// BCC1 of a full-duplex I frame (control 0xC0 to 0xFF) could be FLAG or ESC, which the header is not stuffed for
+#define A_COMPRESSED 0x40
+
+// sequence numbers are 3 bits wide, stop-and-wait only uses 0 and 1
+#define SEQ_BITS_MODULUS 8
+// largest I frame data field before stuffing: payload, frame check sequence and the parity of forward error correction
+#define MAX_DATA_FIELD_SIZE FEC_ENCODED_SIZE(MAX_PAYLOAD_SIZE + MAX_FCS_SIZE)
+// worst case I frame: header, every data field byte stuffed, closing flag
+#define MAX_FRAME_SIZE (4 + 2 * MAX_DATA_FIELD_SIZE + 1)
+
+// control fields for sequence number n, keeping 0x00/0x80, RR0/RR1 and REJ0/REJ1 for 0 and 1
+#define C_I(n) ((((n) & 1) << 7) | (((n) >> 1) << 2))
+#define C_RR(n) (RR0 + (n))
+#define C_REJ(n) (REJ0 + (n))
+// receiver not ready: acknowledges every frame before n like RR(n), and asks the transmitter to stop sending
+#define C_RNR(n) (RNR0 + (n))
+// full-duplex I frame n also carrying the acknowledgement RR(r), in 0xC0 to 0xFF where no other control field is
+#define C_I_ACK(n, r) (0xC0 | ((r) << 3) | (n))
+
+#endif // _FRAME_H_
@@ -0,0 +1,113 @@
+// Frame decoder header.
+// A single incremental decoder for every frame of the link: it takes received bytes in spans
+// of any size and emits one event per complete frame, destuffing and checking the I frame
+// payload in the same pass.
+
+#ifndef _FRAME_DECODER_H_
+#define _FRAME_DECODER_H_
+
+#include "cobs.h"
+#include "compression.h"
+#include "fcs.h"
+#include "fec.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+    FrameNone, // no complete frame yet
+    FrameSet,
+    FrameUa,
+    FrameDisc,
+    FrameRr,
+    FrameRej,
+    FrameRnr,
+    FrameI,
+} FrameType;
+
+typedef struct
+{
+    FrameType type;
+    unsigned char address; // without A_COMPRESSED
+    int sequence;    // n of RR(n), REJ(n), RNR(n) and I(n)
+    int ack;         // r acknowledged by a full-duplex I frame, -1 for other frames
+    int payloadSize; // I frame payload, or capability block of a SET or UA, in the decoder buffer
+    bool valid;      // FALSE if the frame check sequence of the payload failed
+    bool compressed; // the I frame payload is compressed, and still has to be decompressed
+} FrameEvent;
+
+typedef enum
+{
+    DecodeHunt,    // waiting for a FLAG
+    DecodeAddress, // after a FLAG
+    DecodeControl,
+    DecodeBcc1,
+    DecodeClose,   // supervision frame waiting for its closing FLAG, or the capability block of a SET or UA
+    DecodeData,    // I frame payload or capability block
+    DecodeEscaped, // I frame payload or capability block, after ESC
+    DecodeCobs,    // I frame data field with COBS framing
+} DecodeState;
+
+typedef struct
+{
+    DecodeState state;
+    unsigned char address; // as received, A_COMPRESSED included
+    unsigned char control;
+
+    // I frame payload, the frame check sequence is folded in as soon as a byte can no longer be part of it
+    unsigned char *payload;
+    int capacity;
+    int size;
+    FcsType fcsType;
+    uint32_t fcs;
+    int checked;
+    // check sequence of the frame being decoded, fcsType for I frames and CAPABILITY_FCS for capabilities
+    FcsType frameFcsType;
+    int frameFcsSize;
+
+    // forward error correction of I frames, whose check sequence can only be computed once the frame is corrected
+    FecMode fec;
+    bool fecFrame;
+
+    // I frames flagged with A_COMPRESSED are taken with payload compression
+    CompressionMode compression;
+
+    // COBS framing: data bytes left in the current block, and whether a zero comes before the next one
+    FramingMode framing;
+    int cobsLeft;
+    bool cobsZero;
+
+    // control field lookup for the current sequence space
+    unsigned char controlTypes[256];
+    unsigned char controlSequences[256];
+    signed char controlAcks[256];
+
+    // statistics
+    int bcc1Errors;
+    int fcsErrors;
+    int escapes; // ESC bytes, or COBS code bytes
+    int fecCorrected; // bytes fixed by forward error correction
+    int fecFailures;  // I frames with more errors than forward error correction can fix
+} FrameDecoder;
+
+// Prepare a decoder writing I frame payloads to payload, which holds capacity bytes
+// including the frame check sequence and forward error correction parity.
+void decoderInit(FrameDecoder *decoder, unsigned char *payload, int capacity, FcsType fcsType, int seqModulus);
+
+// Select the framing of the I frame data field, FLAG/ESC stuffing after decoderInit.
+void decoderSetFraming(FrameDecoder *decoder, FramingMode framing);
+
+// Select forward error correction of I frames, none after decoderInit.
+void decoderSetFec(FrameDecoder *decoder, FecMode fec);
+
+// Select payload compression, which lets I frames be flagged as compressed, none after decoderInit.
+void decoderSetCompression(FrameDecoder *decoder, CompressionMode compression);
+
+// Also take the I frames of full duplex, which carry an acknowledgement, after decoderInit.
+void decoderSetDuplex(FrameDecoder *decoder);
+
+// Decode bytes from data until a frame is complete or the span ends.
+// Returns the number of bytes used, event->type is FrameNone if no frame was completed.
+int decodeBytes(FrameDecoder *decoder, const unsigned char *data, int size, FrameEvent *event);
+
+#endif // _FRAME_DECODER_H_
@@ -0,0 +1,29 @@
+// Frame sizer header.
+// Picks the I frame payload size that maximises goodput for the error rate the link sees.
+// A frame of n bytes on the wire gets through with probability (1 - p)^8n = e^-kn for a bit error rate p,
+// and costs its n bytes plus a fixed overhead c (header, check sequence and, with stop-and-wait, the time
+// the answer takes). Goodput L e^-kL / (L + c) peaks at L = (sqrt(c^2 + 4c/k) - c) / 2, so large frames
+// on clean links and small ones on noisy links. k is estimated from the frames that had to be sent again.
+
+#ifndef _FRAME_SIZER_H_
+#define _FRAME_SIZER_H_
+
+#include <stdbool.h>
+
+typedef struct
+{
+    double errorRate; // share of frame transmissions that failed, moving average
+    double wireSize;  // size on the wire of those frames, moving average, in bytes
+    int samples;
+} FrameSizer;
+
+// Forget every sample. A zeroed sizer is reset.
+void sizerReset(FrameSizer *sizer);
+
+// Account for a frame transmission of wireSize bytes, failed if it had to be sent again.
+void sizerSample(FrameSizer *sizer, int wireSize, bool failed);
+
+// Return the best payload size between minSize and maxSize, for a fixed cost of overhead bytes per frame.
+int sizerBest(const FrameSizer *sizer, double overhead, int minSize, int maxSize);
+
+#endif // _FRAME_SIZER_H_
@@ -0,0 +1,188 @@
+// Link context header.
+// Re-entrant link layer API: every piece of link state lives in a LinkContext, so one process can run
+// a link on each of several serial ports, from different threads or from one event loop.
+// llopen, llwrite, llread, llclose and llsetoptions are wrappers over one default context.
+
+#ifndef _LINK_CONTEXT_H_
+#define _LINK_CONTEXT_H_
+
+#include "capabilities.h"
+#include "frame.h"
+#include "frame_decoder.h"
+#include "frame_sizer.h"
+#include "link_layer.h"
+#include "link_options.h"
+#include "link_stats.h"
+#include "retransmission_timer.h"
+#include "serial_buffer.h"
+#include "serial_context.h"
+#include <stdbool.h>
+
+// Frames a full-duplex link keeps for llread once they are acknowledged, room for a whole window more than
+// what makes it stop the other end with RNR.
+#define RX_QUEUE_SIZE (2 * SEQ_BITS_MODULUS)
+
+// Bytes a serial driver keeps for a reader that is away, the tty buffer of Linux, which limits the frames
+// the transmitter keeps in flight while the receiver is not ready.
+#define TTY_BUFFER_SIZE 4096
+
+// An I frame kept for transmission until it is acknowledged, built in place with room for the worst case
+// stuffing so that sending and resending it is a single write.
+typedef struct
+{
+    unsigned char frame[MAX_FRAME_SIZE];
+    int size;
+    long builtAt; // when llwrite built it, for the frame latency
+} TxSlot;
+
+typedef struct
+{
+    SerialPort port;
+    ReceiveBuffer receive;
+    RetransmissionTimer timer;
+    bool timerEnabled;
+    int timeoutCount;
+
+    LinkLayerRole role;
+    int nRetransmissions;
+    int timeout;
+
+    // options set by llsetoptionsCtx, offered in the SET/UA exchange
+    LinkOptions requested;
+    // options agreed in the SET/UA exchange: ARQ settings, frame check sequence protecting the payload,
+    // framing of the data field, forward error correction, payload compression, largest payload and full duplex
+    ArqMode arqMode;
+    int windowSize;
+    int seqModulus;
+    FcsType fcsType;
+    FramingMode framing;
+    FecMode fec;
+    CompressionMode compression;
+    int maxPayloadSize;
+    bool duplex;
+    bool flowControl;
+    // address of the I frames this end sends and of those the other end sends, which is also the address
+    // of the RR and REJ answering them
+    unsigned char address;
+    unsigned char peerAddress;
+    // payload size advised by llpayloadsizeCtx, from the frames the transmitter had to send again
+    FrameSizer sizer;
+    // UA the receiver answered the SET with, sent again for a repeated SET
+    unsigned char uaFrame[MAX_CAPABILITY_FRAME_SIZE];
+    int uaSize;
+
+    // next sequence number to send or expect
+    int frameNumber;
+
+    // transmitted frames are kept by sequence number until acknowledged, stop-and-wait uses two of them
+    TxSlot txSlots[SEQ_BITS_MODULUS];
+    // go-back-n and selective repeat transmitter window
+    int windowBase;
+    int windowCount;
+    // when each frame in the window left the port, and whether it was written again since
+    long windowSentAt[SEQ_BITS_MODULUS];
+    bool windowResent[SEQ_BITS_MODULUS];
+
+    // receiver already asked for a frame with a REJ, indexed by sequence number
+    bool rejSent[SEQ_BITS_MODULUS];
+
+    // every phase reads frames through the same decoder, I frames are received in frameBuffer first,
+    // since out of sequence frames may not fit the caller's packet
+    FrameDecoder decoder;
+    unsigned char frameBuffer[MAX_DATA_FIELD_SIZE];
+
+    // selective repeat receiver keeps frames that arrived ahead of frameNumber until they can be delivered
+    unsigned char reorderSlots[SEQ_BITS_MODULUS][MAX_PAYLOAD_SIZE + 1];
+    int reorderSizes[SEQ_BITS_MODULUS];
+    bool reorderFull[SEQ_BITS_MODULUS];
+
+    // full duplex: frames from the other end received while sending, acknowledged and waiting for llread
+    unsigned char rxQueue[RX_QUEUE_SIZE][MAX_PAYLOAD_SIZE];
+    int rxQueueSizes[RX_QUEUE_SIZE];
+    int rxQueueHead;
+    int rxQueueCount;
+
+    // acknowledgement of the unacked frames received last, held back to ride on the next I frame in full duplex,
+    // or until ackEvery frames are waiting for it; it goes as an RR once the port was quiet for ackDelay ms
+    bool ackPending;
+    int unacked;
+    int ackEvery;
+    int ackDelay;
+
+    // flow control: this end sent RNR and must send RR or REJ once it reads again, and the other end sent RNR,
+    // so we keep at most receiveCredit frames in flight and a persist timer of persistDelay ms replaces
+    // the retransmission timer
+    bool notReady;
+    bool peerBusy;
+    int receiveCredit;
+    int persistDelay;
+    long pausedAt;
+    // an application that was slow to call llread again after the frame delivered at deliveredAt is answered
+    // with RNR for slowReads more frames
+    long deliveredAt;
+    int slowReads;
+
+    // statistics
+    int llopenCount, llwriteCount, llreadCount, llcloseCount, bytestuffCount;
+    long payloadBytesSent, payloadBytesReceived;
+    // I frames written to the port and their bytes, I frames written again and how many of them after a REJ
+    int transmissionCount;
+    long frameBytesSent;
+    int retransmissionCount;
+    int rejRetransmissionCount;
+    int duplicateCount;
+    int piggybackCount;
+    int acksSaved;
+    int rnrSent, rnrReceived, probeCount;
+    long pausedTime;
+    // payload bytes given to the compressor and sent for them, frames sent as they were since they did not shrink,
+    // compressed payload bytes received and what they expanded to, and the CPU time of each side in microseconds
+    long plainBytesSent, packedBytesSent;
+    int rawFrameCount;
+    long packedBytesReceived, plainBytesReceived;
+    long compressTime, decompressTime;
+    // round-trip times of the I frames sent once, and the time from llwrite until an I frame was acknowledged
+    Histogram rttHistogram;
+    Histogram latencyHistogram;
+    // when llopen and llclose were done, for the effective throughput
+    long openedAt;
+    long closedAt;
+} LinkContext;
+
+// Link driven by llopen, llwrite, llread and llclose.
+extern LinkContext defaultLink;
+
+// A context must be zeroed before its first use, e.g. LinkContext link = {0}, which selects
+// stop-and-wait with the XOR bcc2. The functions below behave like the ones in link_layer.h
+// and link_options.h, on the link held by ctx.
+
+// Set the options used by the next llopenCtx call on ctx.
+// Return "1" on success or "-1" on invalid options.
+int llsetoptionsCtx(LinkContext *ctx, LinkOptions options);
+
+// Get the options agreed by the last llopenCtx on ctx.
+void llgetoptionsCtx(LinkContext *ctx, LinkOptions *options);
+
+// Get the statistics of ctx.
+void llgetstatsCtx(LinkContext *ctx, LinkStats *stats);
+
+// Return the payload size that currently gives the best goodput on ctx.
+int llpayloadsizeCtx(LinkContext *ctx);
+
+// Open the link on ctx.
+// Return the serial port file descriptor on success or "-1" on error.
+int llopenCtx(LinkContext *ctx, LinkLayer connectionParameters);
+
+// Send data in buf with size bufSize.
+// Return number of chars written, or "-1" on error.
+int llwriteCtx(LinkContext *ctx, const unsigned char *buf, int bufSize);
+
+// Receive data in packet.
+// Return number of chars read, or "-1" on error.
+int llreadCtx(LinkContext *ctx, unsigned char *packet);
+
+// Close the link on ctx, printing its statistics if showStatistics is TRUE.
+// Return "1" on success or "-1" on error.
+int llcloseCtx(LinkContext *ctx, int showStatistics);
+
+#endif // _LINK_CONTEXT_H_
@@ -0,0 +1,71 @@
+// Link layer options header.
+// Extra settings that do not fit in the fixed LinkLayer struct.
+
+#ifndef _LINK_OPTIONS_H_
+#define _LINK_OPTIONS_H_
+
+#include "cobs.h"
+#include "compression.h"
+#include "fcs.h"
+#include "fec.h"
+#include <stdbool.h>
+
+typedef enum
+{
+    ArqStopAndWait,
+    ArqGoBackN,
+    ArqSelectiveRepeat,
+} ArqMode;
+
+// Largest windows allowed by the 3-bit sequence number.
+#define MAX_WINDOW_SIZE 7
+#define MAX_SR_WINDOW_SIZE 4
+
+// Smallest I frame payload a link can be limited to.
+#define MIN_PAYLOAD_SIZE 16
+
+typedef struct
+{
+    ArqMode arqMode;
+    int windowSize; // number of unacknowledged I frames the transmitter may keep in flight
+    FcsType fcsType; // check sequence protecting the I frame payload
+    FramingMode framing; // framing of the I frame data field
+    FecMode fec; // forward error correction of the I frame payload and check sequence
+    CompressionMode compression; // compression of the I frame payloads that shrink
+    bool duplex; // both ends send I frames, which carry the acknowledgements for the other direction
+    bool flowControl; // a receiver that cannot take more frames stops the transmitter with RNR until it can
+    int maxPayloadSize; // largest I frame payload, up to MAX_PAYLOAD_SIZE, 0 for MAX_PAYLOAD_SIZE
+    bool fixedFrameSize; // always advise maxPayloadSize, instead of following the error rate, not negotiated
+    int ackEvery; // the receiver answers every ackEvery I frames with one RR, 0 or 1 for every frame, not negotiated
+} LinkOptions;
+
+// Set the options offered by the next llopen call.
+// In the SET/UA exchange, the receiver takes the ARQ mode, window and framing of the transmitter, the smaller
+// of the two frame sizes and the stronger check sequence, and turns on forward error correction if either end
+// asks for it. Against a peer answering with a plain SET or UA, each end keeps its own options, without forward
+// error correction, so both must be given the same ARQ mode and check sequence. The transmitter only falls back
+// to a plain SET after half of its tries went unanswered, so on a link that loses that many frames the ends
+// may also settle on their own options without noticing.
+// Full duplex is only used when both ends ask for it, and runs on the window: with stop-and-wait it becomes
+// go-back-n with a window of 1.
+// Payload compression is used when both ends ask for it. A payload that does not shrink is sent as it is.
+// Flow control is used when both ends ask for it. While the application reads slowly, from llopen on and after
+// any llread call more than 20 ms after the last frame was handed over, until 16 frames in a row came back
+// sooner, the receiver acknowledges the frames it hands to llread with RNR and sends RR once llread is called
+// again with nothing waiting; otherwise it answers with RR as usual, held back by ackEvery. A full-duplex end
+// sends RNR when its queue fills up. After an RNR the transmitter keeps only the frames the receiver's tty buffer
+// can hold in flight, and probes it on a backing off persist timer instead of timing out, until an RR or REJ
+// says it reads again.
+// A receiver with ackEvery above 1 delays its RR until that many I frames arrived, or until the port goes quiet,
+// at most for half the window so that the transmitter keeps sending meanwhile. A REJ still goes out at once.
+// Return "1" on success or "-1" on invalid options.
+int llsetoptions(LinkOptions options);
+
+// Get the options agreed by the last llopen.
+void llgetoptions(LinkOptions *options);
+
+// Return the payload size that currently gives the best goodput, at most the agreed maxPayloadSize.
+// It shrinks as the share of I frames that must be sent again grows, and grows back as the link clears.
+int llpayloadsize(void);
+
+#endif // _LINK_OPTIONS_H_
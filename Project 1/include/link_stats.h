@@ -0,0 +1,77 @@
+// Link statistics header.
+// A snapshot of what a link did since llopen, for the application to read, and its export as JSON or CSV
+// so that runs can be compared by tools, e.g. to catch efficiency regressions between versions.
+
+#ifndef _LINK_STATS_H_
+#define _LINK_STATS_H_
+
+#include "link_options.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Histogram buckets: bucket 0 counts the samples under 1 ms, bucket i those from 2^(i-1) ms up to 2^i ms,
+// and the last one everything from 2^(STATS_BUCKETS - 2) ms on.
+#define STATS_BUCKETS 16
+
+typedef struct
+{
+    long counts[STATS_BUCKETS];
+    long samples;
+    long sum; // milliseconds
+    long max;
+} Histogram;
+
+typedef struct
+{
+    int role;            // LinkLayerRole
+    LinkOptions options; // as agreed on llopen
+    long elapsed;        // milliseconds from llopen to llclose, or until now while the link is open
+
+    // I frames of this end: built by llwrite, written to the port (retransmissions and probes included),
+    // written again after a timeout or a REJ, and written to probe a receiver that is not ready
+    int framesSent;
+    int transmissions;
+    int timeoutRetransmissions;
+    int rejRetransmissions;
+    int probes;
+    int timeouts;
+    // bytes given to llwrite, bytes of the I frames written to the port, of every frame written to the port,
+    // and what stuffing or COBS added to the I frames
+    long payloadBytesSent;
+    long frameBytesSent;
+    long wireBytesSent;
+    long stuffingBytesSent;
+
+    // I frames of the other end: handed to llread, repeated ones, and frames dropped for a bad header or
+    // payload check; bytes handed to llread, read from the port, and removed by destuffing or COBS
+    int framesReceived;
+    int duplicates;
+    int bcc1Errors;
+    int bcc2Errors;
+    long payloadBytesReceived;
+    long wireBytesReceived;
+    long stuffingBytesReceived;
+
+    // retransmission timeout and smoothed round-trip time at the time of the snapshot, in milliseconds,
+    // the round-trip times of the I frames sent once, and the time from llwrite until an I frame was acknowledged
+    int rto;
+    int srtt;
+    Histogram rtt;
+    Histogram latency;
+} LinkStats;
+
+// Count a sample of the given milliseconds in histogram.
+void histogramAdd(Histogram *histogram, long milliseconds);
+
+// Get the statistics of the link of llopen.
+void llgetstats(LinkStats *stats);
+
+// Write stats as one JSON object, the histograms as their bucket counts.
+// Returns -1 on error.
+int statsWriteJson(const LinkStats *stats, FILE *out);
+
+// Write stats as one CSV row, after the row of column names if header is TRUE.
+// Returns -1 on error.
+int statsWriteCsv(const LinkStats *stats, FILE *out, bool header);
+
+#endif // _LINK_STATS_H_
@@ -0,0 +1,94 @@
+// Link trace header.
+// Logging for the link layer in two parts. Messages go through LOG_ERROR, LOG_INFO and LOG_DEBUG, of which
+// only those up to LL_LOG_LEVEL are compiled in, so the per-frame ones cost nothing by default. What happens
+// to each frame is recorded instead as a 16-byte binary event in a fixed-size ring, lock-free so that every
+// thread and signal handler can add to it, which is written to a file on llclose and when the process is
+// interrupted, for post-mortem traces.
+
+#ifndef _LINK_TRACE_H_
+#define _LINK_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1 // failures, with the transfer aborted
+#define LOG_LEVEL_INFO 2  // once per link: options on llopen and statistics on llclose
+#define LOG_LEVEL_DEBUG 3 // every frame, as traced in the ring
+
+// Messages compiled in, e.g. -DLL_LOG_LEVEL=3 for every frame.
+#ifndef LL_LOG_LEVEL
+#define LL_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Messages above LL_LOG_LEVEL are still type checked, and then dropped by the compiler.
+#define LOG_AT(level, ...)            \
+    do                                \
+    {                                 \
+        if (LL_LOG_LEVEL >= (level))  \
+        {                             \
+            printf(__VA_ARGS__);      \
+        }                             \
+    } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+typedef enum
+{
+    TraceOpen,        // llopen done, length: largest payload, value: ARQ mode
+    TraceClose,       // llclose done
+    TraceSend,        // I frame written, length: frame size
+    TraceResend,      // I frame written again after a timeout or a REJ
+    TraceProbe,       // I frame written again to probe a receiver that is not ready
+    TraceTimeout,     // retransmission timer expired, value: consecutive timeouts
+    TraceFrame,       // frame received, length: payload size, value: FrameType
+    TraceBadFrame,    // I frame received whose check sequence failed, length: payload size
+    TraceSupervision, // RR, REJ or RNR sent, value: control field
+    TraceDeliver,     // payload handed to llread, length: payload size
+    TraceFrameStart,  // bytes of a new frame read after the link was idle, length: bytes in the read
+    TraceBcc1Error,   // frames dropped for a bad header, value: how many
+    TraceAck,         // I frame acknowledged, length: frame size, value: milliseconds since llwrite
+} TraceType;
+
+// Every event is also a USDT probe of the provider "link" for perf and bpftrace, built in when <sys/sdt.h>
+// (systemtap-sdt-dev) is installed: open, close, frame_sent, frame_resent, frame_probe, timeout,
+// frame_received, bcc2_error, supervision_sent, delivered, frame_start, bcc1_error and frame_acked, with the
+// link, sequence, length, value and time of the event as arguments 0 to 4. A probe nobody attached to is a nop.
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LINK_PROBES
+#endif
+#endif
+
+// Events are kept in native byte order; the file holds TRACE_MAGIC, the event size and the event count as
+// two uint32_t, then the events, oldest first.
+typedef struct
+{
+    uint64_t time;   // nanoseconds on the monotonic clock
+    uint16_t link;   // file descriptor of the serial port
+    uint16_t length; // depends on the type, see TraceType
+    uint8_t type;    // TraceType
+    uint8_t sequence;
+    uint16_t value; // depends on the type, see TraceType
+} TraceEvent;
+
+// Events kept, the oldest ones are overwritten, a power of two.
+#define TRACE_EVENTS 16384
+#define TRACE_MAGIC "LLTRACE\0"
+
+// Record an event in the ring, and fire the USDT probe of its type, if built in.
+void traceEvent(int link, TraceType type, int sequence, int length, int value);
+
+// Write the ring to path on traceDump, and when SIGINT, SIGTERM or SIGUSR1 arrive; the first two then
+// end the process as they would have, SIGUSR1 lets it go on.
+// Returns -1 if path is too long or the handlers cannot be installed.
+int traceSetFile(const char *path);
+
+// Write the events in the ring to the file set by traceSetFile, if any, using only async-signal-safe calls.
+// Events added meanwhile by other threads may come out torn.
+// Returns -1 on error.
+int traceDump(void);
+
+#endif // _LINK_TRACE_H_
@@ -0,0 +1,80 @@
+// Retransmission timer header.
+// One-shot millisecond timer on the monotonic clock (timerfd), waited on with poll together with the
+// serial port. The timeout (RTO) follows the measured round-trip times as in RFC 6298, counted from
+// the moment a frame has left the port at the link baud rate, so that queued frames do not inflate it.
+
+#ifndef _RETRANSMISSION_TIMER_H_
+#define _RETRANSMISSION_TIMER_H_
+
+#include <stdbool.h>
+
+// Bounds of the retransmission timeout, in milliseconds.
+#define MIN_RTO_MS 50
+#define MAX_RTO_MS 60000
+
+typedef struct
+{
+    int fd;          // timerfd, only valid while open
+    bool open;
+    long expectedAt; // when the running timer started waiting on an idle link, 0 if it is not running
+    bool persist;    // the running timer is a persist timer, see timerPersist
+
+    // time to send one byte (start, 8 data and stop bits), in nanoseconds, and when the port will be idle
+    long byteTime;
+    long linkFreeAt;
+    // extra wait for answers that go out after frames the other end is sending, in milliseconds
+    long answerDelay;
+
+    // round-trip estimate and timeout, in milliseconds
+    int rto;
+    int srtt;
+    int rttvar;
+
+    // statistics
+    int expiryCount;
+    long lostTime;
+} RetransmissionTimer;
+
+// Create the timer for a link at baudRate, starting with a timeout of initialRto milliseconds
+// and no round-trip estimate. A zeroed timer counts as closed.
+// Returns -1 on error.
+int timerOpen(RetransmissionTimer *timer, int initialRto, int baudRate);
+
+// Release the timer.
+void timerClose(RetransmissionTimer *timer);
+
+// Account for bytes just written to the serial port.
+// Returns the time, in milliseconds, at which their last byte will have been sent.
+long timerSent(RetransmissionTimer *timer, int bytes);
+
+// Allow answers to wait for up to bytes of frames the other end sends, e.g. the acknowledgements
+// carried by the I frames of a full-duplex link.
+void timerSetAnswerDelay(RetransmissionTimer *timer, int bytes);
+
+// Arm the timer to expire one timeout, plus the answer delay, after everything written so far was sent,
+// restarting it if it was running.
+void timerStart(RetransmissionTimer *timer);
+
+// Arm the timer to expire milliseconds after everything written so far was sent, e.g. to probe a receiver
+// that asked us to stop sending. Its expiry does not back the timeout off nor count in the statistics.
+void timerPersist(RetransmissionTimer *timer, int milliseconds);
+
+// Disarm the timer.
+void timerStop(RetransmissionTimer *timer);
+
+// Wait until fd has bytes to read or the timer expires. An expiry doubles the timeout (backoff).
+// Returns 1 if fd is readable, 0 if the timer expired, -1 on error.
+int timerWait(RetransmissionTimer *timer, int fd);
+
+// Current monotonic time, in milliseconds.
+long timerNow();
+
+// Feed a round-trip time sample, in milliseconds from the time returned by timerSent to the answer,
+// and recompute the timeout. Following Karn's rule, only frames that were sent once may give a sample.
+void timerSample(RetransmissionTimer *timer, long rtt);
+
+// Get the number of expiries, the time lost waiting for them after the link went idle,
+// the current timeout and the smoothed round-trip time (0 if there was no sample yet), in milliseconds.
+void timerStats(const RetransmissionTimer *timer, int *expiries, long *lost, int *timeout, int *smoothedRtt);
+
+#endif // _RETRANSMISSION_TIMER_H_
@@ -0,0 +1,16 @@
+// Serial port baud rate header.
+// Sets any baud rate on a tty through the termios2 interface of Linux, with BOTHER in place of a Bxxx
+// constant, for USB serial adapters that run at 921600 baud and more, or at rates termios has no name for.
+// Kept apart from serial_context.c because <asm/termbits.h> clashes with <termios.h>.
+
+#ifndef _SERIAL_BAUD_H_
+#define _SERIAL_BAUD_H_
+
+// Highest baud rate a port is opened at.
+#define MAX_BAUD_RATE 4000000
+
+// Set the input and output baud rate of the tty at fd to baudRate, keeping its other settings.
+// Returns -1 on error, or if the driver settled on a rate more than 2% away.
+int setBaudRate(int fd, int baudRate);
+
+#endif // _SERIAL_BAUD_H_
@@ -0,0 +1,48 @@
+// Buffered serial port receive header.
+// Reads as many bytes as are available in one call and hands them out from a ring buffer.
+
+#ifndef _SERIAL_BUFFER_H_
+#define _SERIAL_BUFFER_H_
+
+#include "serial_context.h"
+
+// Size of the receive ring buffer, in bytes.
+#define RECEIVE_BUFFER_SIZE 4096
+
+typedef struct
+{
+    SerialPort *port; // serial port the buffer reads from
+    unsigned char data[RECEIVE_BUFFER_SIZE];
+    int start; // index of the oldest buffered byte
+    int count; // number of buffered bytes
+
+    // statistics
+    long readCalls;
+    long bytesReceived;
+} ReceiveBuffer;
+
+// Drop any buffered bytes and read from port from now on, used when a port is opened.
+void resetReceiveBuffer(ReceiveBuffer *buffer, SerialPort *port);
+
+// Read from the serial port into the ring buffer, waiting like readByte when nothing is available.
+// Returns -1 on error, otherwise the number of bytes added.
+int fillReceiveBuffer(ReceiveBuffer *buffer);
+
+// Get the buffered bytes that are contiguous in the ring buffer, without reading the port.
+// Returns the number of bytes available at *span.
+int receivedSpan(const ReceiveBuffer *buffer, const unsigned char **span);
+
+// Remove count bytes from the front of the ring buffer.
+void consumeReceived(ReceiveBuffer *buffer, int count);
+
+// Number of bytes in the ring buffer.
+int receivedCount(const ReceiveBuffer *buffer);
+
+// Buffered replacement for readByte: take one byte from the ring buffer, refilling it when empty.
+// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
+int readBufferedByte(ReceiveBuffer *buffer, char *byte);
+
+// Get the number of read calls made on the serial port and the bytes they returned.
+void receiveBufferStats(const ReceiveBuffer *buffer, long *readCalls, long *bytesReceived);
+
+#endif // _SERIAL_BUFFER_H_
@@ -0,0 +1,41 @@
+// Re-entrant serial port header.
+// Opens and configures a port exactly like serial_port.c, but the port state is kept by the caller,
+// so that one process can have several ports open. The port may also be another byte stream than a tty,
+// chosen by the prefix of its name, see transport.h.
+
+#ifndef _SERIAL_CONTEXT_H_
+#define _SERIAL_CONTEXT_H_
+
+#include <termios.h>
+
+typedef struct Transport Transport;
+
+typedef struct SerialPort
+{
+    const Transport *transport;
+    int fd;                // read from, and polled for received bytes
+    int writeFd;           // written to, the same as fd but for a pipe pair
+    struct termios oldtio; // settings to restore on closing a tty
+    void *state;           // private to the transport
+
+    // statistics
+    long bytesWritten;
+} SerialPort;
+
+// Open and configure the serial port, or the transport named by its prefix.
+// Returns the file descriptor, or -1 on error.
+int serialOpen(SerialPort *port, const char *serialPort, int baudRate);
+
+// Restore original port settings and close the serial port.
+// Returns -1 on error.
+int serialClose(SerialPort *port);
+
+// Read up to numBytes from the serial port.
+// Returns -1 on error, otherwise the number of bytes read, 0 if none came in time.
+int serialRead(SerialPort *port, unsigned char *bytes, int numBytes);
+
+// Write up to numBytes to the serial port.
+// Returns -1 on error, otherwise the number of bytes written.
+int serialWrite(SerialPort *port, const unsigned char *bytes, int numBytes);
+
+#endif // _SERIAL_CONTEXT_H_
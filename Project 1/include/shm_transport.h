@@ -0,0 +1,50 @@
+// Shared memory transport header.
+// Joins the two ends of a link, threads of one process or two processes, through a region of POSIX shared
+// memory with one lock-free single-producer single-consumer ring per direction. Bytes are copied into the
+// ring and out of it with no system call but for a doorbell: a writer that finds the ring drained rings the
+// named pipe the reader polls, so the reader sleeps in timerWait as on a tty while bursts cost nothing.
+// The port name is shm:<name> with options for the bytes this end writes:
+//   ber=<p>     probability of a bit error, drawn for each byte with a xorshift PRNG
+//   delay=<ms>  time before the reader gets them, which it waits for in read
+//   seed=<n>    seed of the PRNG, so that a run with errors can be repeated
+// The first end to open a name creates the region, the second one removes its name. A run that crashed
+// may leave it in /dev/shm, to be removed by hand.
+
+#ifndef _SHM_TRANSPORT_H_
+#define _SHM_TRANSPORT_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Bytes of each ring and writes of a delayed ring waiting to be due, powers of two.
+#define SHM_RING_SIZE 65536
+#define SHM_MARKS 1024
+
+// End of a write to a delayed ring, and when it is due, in nanoseconds on the monotonic clock.
+typedef struct
+{
+    uint64_t dueAt;
+    uint32_t end;
+} ShmMark;
+
+// Positions run freely and wrap around, the byte at position i is data[i % SHM_RING_SIZE]; the producer
+// and the consumer positions are on cache lines of their own.
+typedef struct
+{
+    _Alignas(64) atomic_uint head; // written up to, by the producer
+    atomic_uint markHead;
+    uint64_t delay;                // nanoseconds, 0 for no marks
+    atomic_int closed;             // the producer closed its end
+    _Alignas(64) atomic_uint tail; // read up to, by the consumer
+    atomic_uint markTail;
+    ShmMark marks[SHM_MARKS];
+    unsigned char data[SHM_RING_SIZE];
+} ShmRing;
+
+typedef struct
+{
+    atomic_uint ends; // ends opened, the first one writes rings[0]
+    ShmRing rings[2];
+} ShmRegion;
+
+#endif // _SHM_TRANSPORT_H_
@@ -0,0 +1,20 @@
+// Byte stuffing header.
+// FLAG/ESC stuffing kernels that look for FLAG and ESC 32 (AVX2) or 16 (SSE2) bytes at a time and copy
+// the runs between them in bulk. AVX2 is picked at run time when the CPU has it, other machines use a
+// scalar loop.
+
+#ifndef _STUFFING_H_
+#define _STUFFING_H_
+
+#include "fcs.h"
+#include <stdint.h>
+
+// Return the index of the first FLAG or ESC in data, or size if there is none.
+int findSpecial(const unsigned char *data, int size);
+
+// Stuff size bytes of data into out, which must hold 2 * size bytes. Unless fcs is NULL, the bytes are
+// folded into the frame check sequence *fcs of the given type in the same pass.
+// Returns the number of bytes written, adding the number of escaped bytes to *escapes.
+int stuffBytes(unsigned char *out, const unsigned char *data, int size, FcsType type, uint32_t *fcs, int *escapes);
+
+#endif // _STUFFING_H_
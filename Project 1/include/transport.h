@@ -0,0 +1,54 @@
+// Transport header.
+// The byte streams a link runs over, as a table of functions per kind of stream. The name given to llopen
+// picks the transport by its prefix, the rest being its address:
+//   tty:<device> or just <device>   a serial port, configured like serial_port.c
+//   pipe:<out>,<in>                  a pair of named pipes, written to <out> and read from <in>, created
+//                                    if missing; the other end opens pipe:<in>,<out>
+//   socketpair:<name>                a UNIX socket pair within one process, the second port opened with
+//                                    the same name gets the other end
+//   tcp:<host>:<port>                a TCP connection, the end that starts first listens on <port>
+//   shm:<name>[,ber=<p>][,delay=<ms>][,seed=<n>]
+//                                    two lock-free rings in shared memory, see shm_transport.h
+// Only the tty runs at the baud rate, the others carry bytes as fast as both ends handle them, so that the
+// processor time of the protocol can be measured apart from the line, and tests need no ptys nor root.
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "serial_context.h"
+#include <stdbool.h>
+
+struct Transport
+{
+    const char *prefix; // of the port names it opens
+    bool paced;         // bytes take their time at the baud rate, which the retransmission timer adds
+
+    // Open the stream at address, setting the fd and writeFd of port.
+    // Returns the fd, or -1 on error.
+    int (*open)(SerialPort *port, const char *address, int baudRate);
+    // Read up to numBytes, once poll found port->fd readable.
+    // Returns -1 on error or when the other end is gone, otherwise the number of bytes read.
+    int (*read)(SerialPort *port, unsigned char *bytes, int numBytes);
+    // Write up to numBytes.
+    // Returns -1 on error, otherwise the number of bytes written.
+    int (*write)(SerialPort *port, const unsigned char *bytes, int numBytes);
+    // Close the stream.
+    // Returns -1 on error.
+    int (*close)(SerialPort *port);
+};
+
+extern const Transport ttyTransport;
+extern const Transport pipeTransport;
+extern const Transport socketPairTransport;
+extern const Transport tcpTransport;
+extern const Transport shmTransport;
+
+// Write to a pipe or FIFO, failing with EPIPE instead of raising SIGPIPE once the other end is closed.
+// Returns -1 on error, otherwise the number of bytes written.
+int pipeWrite(int fd, const void *bytes, int numBytes);
+
+// Find the transport of a port name, the tty for a name without a known prefix.
+// Returns the transport, with the address in the name at *address.
+const Transport *findTransport(const char *name, const char **address);
+
+#endif // _TRANSPORT_H_
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# A virtual cable like cable/cable.c, for the baud rates above 115200 it does not take: two pty pairs
+# joined back to back, each direction paced to the baud rate, with optional bit errors. No root is needed,
+# the ends are symbolic links to the ptys.
+#   $ python3 scripts/fast_cable.py 921600 /tmp/ttyTX /tmp/ttyRX &
+#   $ LL_BAUD=921600 ./bin/main /tmp/ttyRX 115200 rx penguin-received.gif &
+#   $ LL_BAUD=921600 ./bin/main /tmp/ttyTX 115200 tx penguin.gif
+# Bytes are paced against a deadline rather than by sleeping after each read, so the rate holds at
+# megabaud even though a sleep takes tens of microseconds.
+
+import argparse
+import os
+import pty
+import random
+import signal
+import threading
+import time
+import tty
+
+
+def pump(source, sink, baud, ber):
+    byteTime = 10 / baud
+    freeAt = time.monotonic()
+    while True:
+        data = bytearray(os.read(source, 4096))
+        for i in range(len(data) if ber > 0 else 0):
+            if random.random() < ber * 8:
+                data[i] ^= 1 << random.randrange(8)
+        # the bytes start once the line is done with the earlier ones, and come out after their time on it
+        freeAt = max(freeAt, time.monotonic()) + len(data) * byteTime
+        wait = freeAt - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+        os.write(sink, data)
+
+
+def openEnd(link):
+    master, slave = pty.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    if os.path.lexists(link):
+        os.unlink(link)
+    os.symlink(os.ttyname(slave), link)
+    return master
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Virtual serial cable at any baud rate")
+    parser.add_argument("baud", type=int)
+    parser.add_argument("tx", nargs="?", default="/tmp/ttyTX", help="end of the transmitter")
+    parser.add_argument("rx", nargs="?", default="/tmp/ttyRX", help="end of the receiver")
+    parser.add_argument("--ber", type=float, default=0, help="bit error rate, both ways")
+    args = parser.parse_args()
+
+    tx = openEnd(args.tx)
+    rx = openEnd(args.rx)
+    print(f"Cable at {args.baud} baud between {args.tx} and {args.rx}, Ctrl-C to unplug it")
+    # the signals that unplug the cable are blocked, in the pumps too, and taken by the main thread
+    unplug = {signal.SIGINT, signal.SIGTERM}
+    signal.pthread_sigmask(signal.SIG_BLOCK, unplug)
+    threading.Thread(target=pump, args=(tx, rx, args.baud, args.ber), daemon=True).start()
+    threading.Thread(target=pump, args=(rx, tx, args.baud, args.ber), daemon=True).start()
+    signal.sigwait(unplug)
+    os.unlink(args.tx)
+    os.unlink(args.rx)
+
+
+if __name__ == "__main__":
+    main()
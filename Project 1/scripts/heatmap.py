@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# Per-frame latency and retransmission heatmaps of a transfer, from the CSV of link_events.bt or from
+# the trace file written with LL_TRACE.
+#   $ LL_TRACE=tx.trace make run_tx
+#   $ python3 scripts/heatmap.py tx.trace
+# Each row is a slice of the transfer. The latency map has a column per power of two milliseconds from
+# llwrite until the frame was acknowledged, the retransmission map one per sequence number, and a
+# darker cell stands for more frames.
+
+import argparse
+import struct
+import sys
+
+# TraceType in include/link_trace.h, named as the USDT probes
+EVENTS = ["open", "close", "frame_sent", "frame_resent", "frame_probe", "timeout", "frame_received",
+          "bcc2_error", "supervision_sent", "delivered", "frame_start", "bcc1_error", "frame_acked"]
+MAGIC = b"LLTRACE\0"
+SHADES = " .:-=+*#%@"
+LATENCY_BUCKETS = 16
+
+
+def read_trace(path):
+    with open(path, "rb") as file:
+        data = file.read()
+    size, count = struct.unpack_from("=II", data, len(MAGIC))
+    events = []
+    for i in range(count):
+        time, link, length, kind, sequence, value = struct.unpack_from("=QHHBBH", data, len(MAGIC) + 8 + i * size)
+        if kind < len(EVENTS):
+            events.append((time, EVENTS[kind], link, sequence, length, value))
+    return events
+
+
+def read_csv(path):
+    events = []
+    with open(path) as file:
+        for line in file:
+            fields = line.strip().split(",")
+            if len(fields) != 6 or not fields[0].isdigit():
+                continue
+            # bpftrace names the probe as usdt:<binary>:link:<event>
+            events.append((int(fields[0]), fields[1].split(":")[-1], *map(int, fields[2:])))
+    return events
+
+
+def latency_bucket(milliseconds):
+    bucket = 0
+    while bucket < LATENCY_BUCKETS - 1 and milliseconds >= 1 << bucket:
+        bucket += 1
+    return bucket
+
+
+# Print rows as a map, each line starting at the millisecond of the transfer its slice starts at.
+def draw(title, rows, step):
+    peak = max((count for row in rows for count in row), default=0)
+    print(title)
+    print("%8s |%s|" % ("ms", "".join(str(column % 10) for column in range(len(rows[0])))))
+    for i, row in enumerate(rows):
+        cells = "".join(SHADES[0 if count == 0 else 1 + (count - 1) * (len(SHADES) - 2) // max(peak - 1, 1)]
+                        for count in row)
+        print("%8d |%s| %d" % (i * step // 1000000, cells, sum(row)))
+    print("darkest cell: %d frames" % peak)
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Latency and retransmission heatmaps of a link trace.")
+    parser.add_argument("file", help="LL_TRACE file, or CSV from link_events.bt")
+    parser.add_argument("--rows", type=int, default=20, help="slices of the transfer (default 20)")
+    parser.add_argument("--link", type=int, help="only the link on this file descriptor")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as file:
+        binary = file.read(len(MAGIC)) == MAGIC
+    events = read_trace(args.file) if binary else read_csv(args.file)
+    events = [event for event in events if args.link is None or event[2] == args.link]
+    if not events:
+        print("No events.")
+        return 1
+    events.sort()
+    start = events[0][0]
+    step = max((events[-1][0] - start) // args.rows + 1, 1)
+
+    latency = [[0] * LATENCY_BUCKETS for _ in range(args.rows)]
+    sequences = 1 + max((event[3] for event in events if event[1] == "frame_sent"), default=0)
+    resent = [[0] * sequences for _ in range(args.rows)]
+    for time, name, link, sequence, length, value in events:
+        row = (time - start) // step
+        if name == "frame_acked":
+            latency[row][latency_bucket(value)] += 1
+        elif name in ("frame_resent", "frame_probe") and sequence < sequences:
+            resent[row][sequence] += 1
+
+    draw("Latency from llwrite to acknowledgement, column i: under 2^i ms", latency, step)
+    draw("Retransmissions, column n: sequence number n (mod 10 in the header)", resent, step)
+    timeouts = sum(1 for event in events if event[1] == "timeout")
+    errors = sum(event[5] if event[1] == "bcc1_error" else 1 for event in events
+                 if event[1] in ("bcc1_error", "bcc2_error"))
+    print("%d timeouts, %d frames with a check sequence error" % (timeouts, errors))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Throughput of the link layer alone: send a file between two bin/main over the shared memory transport,
+# several times, and print the frames per second and the processor time per frame of each end.
+# Link options come from the environment as usual, shm options from SHM (e.g. ",ber=1e-6,seed=7").
+#   $ scripts/shm_bench.sh penguin.gif 5
+#   $ LL_ARQ=sr LL_FCS=crc32 SHM=",ber=1e-5" scripts/shm_bench.sh penguin.gif
+
+FILE=${1:?usage: shm_bench.sh <file> [runs]}
+RUNS=${2:-3}
+BIN=${BIN:-./bin/main}
+OUT=$(mktemp)
+TIMEFORMAT="%R %U %S"
+
+for run in $(seq "$RUNS"); do
+    name="bench$$-$run$SHM"
+    { time "$BIN" "shm:$name" 115200 rx "$OUT" > "$OUT.rx" 2>&1; } 2> "$OUT.rxtime" &
+    { time "$BIN" "shm:$name" 115200 tx "$FILE" > "$OUT.tx" 2>&1; } 2> "$OUT.txtime"
+    wait
+    cmp -s "$FILE" "$OUT" && result=OK || result=FAIL
+    frames=$(sed -n 's/^llwrite was called \([0-9]*\) times/\1/p' "$OUT.tx")
+    seconds=$(sed -n 's/^Time: \([0-9.]*\) .*/\1/p' "$OUT.tx")
+    read -r _ txUser txSystem < "$OUT.txtime"
+    read -r _ rxUser rxSystem < "$OUT.rxtime"
+    awk -v r="$run" -v res="$result" -v f="$frames" -v s="$seconds" \
+        -v tx="$txUser + $txSystem" -v rx="$rxUser + $rxSystem" \
+        'BEGIN { split(tx, t, " [+] "); split(rx, x, " [+] ")
+                 printf "run %d %s: %d frames in %.4f s, %.0f frames/s, %.2f us of CPU per frame on tx, %.2f us on rx\n",
+                        r, res, f, s, f / s, (t[1] + t[2]) * 1e6 / f, (x[1] + x[2]) * 1e6 / f }'
+done
+rm -f "$OUT" "$OUT.rx" "$OUT.tx" "$OUT.rxtime" "$OUT.txtime"
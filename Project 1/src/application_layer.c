@@ -1,23 +1,49 @@
 // Application layer protocol implementation
 
 #include "application_layer.h"
+#include "bonding.h"
+#include "link_context.h"
 #include "link_layer.h"
+#include "link_options.h"
+#include "link_stats.h"
+#include "link_trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
+#ifdef LL_TEST_HOOKS
+#include <unistd.h>
+#endif
 
 #define MAX_FILE_NAME 255 // the length of filename needs to fit into 1 byte, and for almost all practical purposes, it does
 
 int sendControlPacket(int controlValue, const char *filename, int fileSize);
 int sendDataPackets(FILE *file, int fileSize);
+int sendDataPacket(FILE *file, int *bytesRemaining, int *sequenceNumber);
 int receiveDataPackets(const char *filename, int fileSize);
-double calculateAverageFrameSizeBits(void);
-// Declare these variables as external if they are defined elsewhere (e.g., in link_layer.c)
-extern int frameCount;
-extern int totalFrameSize;
+int writeDataPacket(FILE *file, const unsigned char *packet, int *fileSize, int *sequenceNumber);
+int exchangeFiles(const char *sendName, const char *receiveName);
+void readLinkOptions(LinkOptions *options);
+int openBondedLinks(LinkLayer connectionParameters, LinkOptions options);
+void closeLinks(int showStatistics);
+int exportStats(const char *path, const LinkStats *stats, int count);
+
+// links the data packets are striped over, the first one being the link of llopen
+LinkContext *bondedLinks[MAX_BOND_LINKS];
+int bondedLinkCount = 0;
+
+// payload bytes carried both ways, and I frames written with their bytes, over all links, gathered by closeLinks
+long payloadBytes = 0;
+int frameTransmissions = 0;
+long frameBytes = 0;
+
+#ifdef LL_TEST_HOOKS
+// extra time the receiver takes to write each data packet, in milliseconds, to try flow control with a slow disk;
+// only in a build for tests, with -DLL_TEST_HOOKS
+int writeDelay = 0;
+#endif
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename)
@@ -36,9 +62,34 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
     strcpy(connectionParameters.serialPort, serialPort);
     connectionParameters.role = (strcmp(role, "tx") == 0) ? LlTx : LlRx;
     connectionParameters.baudRate = baudRate;
+    // main only takes rates up to 115200, LL_BAUD gives the ones of faster USB adapters
+    const char *baud = getenv("LL_BAUD");
+    if (baud != NULL)
+    {
+        connectionParameters.baudRate = baudRate = atoi(baud);
+    }
     connectionParameters.nRetransmissions = nTries;
     connectionParameters.timeout = timeout;
 
+    // extra link options come from the environment, since the command line is fixed
+    LinkOptions options;
+    readLinkOptions(&options);
+    if (llsetoptions(options) < 0)
+    {
+        printf("Invalid link options.\n");
+        return;
+    }
+#ifdef LL_TEST_HOOKS
+    const char *delay = getenv("LL_WRITE_DELAY");
+    writeDelay = delay != NULL ? atoi(delay) : 0;
+#endif
+    const char *trace = getenv("LL_TRACE");
+    if (trace != NULL && traceSetFile(trace) < 0)
+    {
+        printf("Invalid trace file %s.\n", trace);
+        return;
+    }
+
     // open the port 
     int fd = llopen(connectionParameters);
     if (fd < 0)
@@ -46,19 +97,47 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         printf("Error opening link layer.\n");
         return;
     }
+    if (openBondedLinks(connectionParameters, options) < 0)
+    {
+        printf("Error opening bonded links.\n");
+        closeLinks(0);
+        return;
+    }
 
     struct timeval start_time, end_time;
     gettimeofday(&start_time, NULL);
 
+    // with LL_DUPLEX both ends send a file and receive the one of the other end at the same time, the
+    // LL_DUPLEX file being the one the transmitter receives into and the receiver sends
+    const char *duplexFile = getenv("LL_DUPLEX");
+    if (duplexFile != NULL)
+    {
+        LinkOptions agreed;
+        llgetoptions(&agreed);
+        if (!agreed.duplex || bondedLinkCount > 1)
+        {
+            printf("Full duplex needs both ends to ask for it, on a single link!\n");
+            closeLinks(0);
+            return;
+        }
+        const char *sendName = connectionParameters.role == LlTx ? filename : duplexFile;
+        const char *receiveName = connectionParameters.role == LlTx ? duplexFile : filename;
+        if (exchangeFiles(sendName, receiveName) < 0)
+        {
+            printf("Error exchanging files!\n");
+            closeLinks(0);
+            return;
+        }
+    }
     // transmitter opens file, sends control packet(START), sends data, and another control packet (END)
-    if (connectionParameters.role == LlTx)
+    else if (connectionParameters.role == LlTx)
     {
         // open the specified file to send, with read permissions, binary mode
         FILE *file = fopen(filename, "rb");
         if (file == NULL)
         {
             printf("Error opening file.\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
 
@@ -71,19 +150,20 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         if (sendControlPacket(1, filename, fileSize) < 0)
         {
             printf("Send START control packet error, transmitter side!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
-        if (sendDataPackets(file, fileSize))
+        int result = bondedLinkCount > 1 ? bondSend(bondedLinks, bondedLinkCount, file, fileSize) : sendDataPackets(file, fileSize);
+        if (result < 0)
         {
             printf("Send data packet error, receiver side!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
         if (sendControlPacket(3, filename, fileSize) < 0)
         {
             printf("Send END control packet error, transmitter side!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
 
@@ -98,14 +178,14 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         if (llread(receivedControlPacket) < 0)
         {
             printf("Error reading START control packet!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
         // check if it it START packet
         if(receivedControlPacket[0] != 1)
         {
             printf("Wrong control value for START!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
 
@@ -114,10 +194,27 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         memcpy(&fileSize, &receivedControlPacket[1 + 2], sizeof(fileSize));
 
         // process data packets
-        if (receiveDataPackets(filename, fileSize) < 0) 
+        int result;
+        if (bondedLinkCount > 1)
+        {
+            FILE *file = fopen(filename, "wb");
+            if (file == NULL)
+            {
+                printf("Error creating file.\n");
+                closeLinks(0);
+                return;
+            }
+            result = bondReceive(bondedLinks, bondedLinkCount, file, fileSize);
+            fclose(file);
+        }
+        else
+        {
+            result = receiveDataPackets(filename, fileSize);
+        }
+        if (result < 0)
         {
             printf("Error on receive data packets!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
 
@@ -125,14 +222,14 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         if (llread(receivedControlPacket) < 0)
         {
             printf("Error reading START control packet!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
         // check if it it END packet
         if(receivedControlPacket[0] != 3)
         {
             printf("Wrong control value for END!\n");
-            llclose(0);
+            closeLinks(0);
             return;
         }
     }
@@ -142,32 +239,207 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
     }
 
     // both of them close the port after they are finished
-    llclose(1);
+    closeLinks(1);
 
     gettimeofday(&end_time, NULL);
     double transmission_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
-    int avgFrameSizeBits = calculateAverageFrameSizeBits();
-    double Tframe = avgFrameSizeBits / transmission_time;
-    // Calculate throughput
-    int totalBytesSent = totalFrameSize; // In bytes
-    double throughput = (totalBytesSent * 8.0) / transmission_time;
+    // the I frames as they went on the wire, retransmissions included, and the time one takes at the baud rate
+    int avgFrameSizeBits = frameTransmissions > 0 ? frameBytes * 8 / frameTransmissions : 0;
+    double Tframe = (double)avgFrameSizeBits / baudRate;
+    // Calculate throughput, from the file and control packets the links delivered
+    double throughput = (payloadBytes * 8.0) / transmission_time;
     printf("Time: %2f segundos\n", transmission_time);
     printf("Average Frame Size: %d bits\n", avgFrameSizeBits);
-    printf("TFrame: %2f bits\n", Tframe);
+    printf("TFrame: %2f seconds\n", Tframe);
     printf("Throughput: %2f bits/second\n", throughput);
 }
 
-double calculateAverageFrameSizeBits()
+// Fill the link options from the environment:
+//   LL_ARQ: "sw" for stop-and-wait (default), "gbn" for go-back-n or "sr" for selective repeat.
+//   LL_WINDOW: window size (default 7 for go-back-n, 4 for selective repeat).
+//   LL_FCS: "xor" for the single bcc2 byte (default), "crc16" or "crc32".
+//   LL_FRAMING: "cobs" for the transmitter to ask for COBS framing instead of byte stuffing.
+//   LL_FEC: "rs" to ask for Reed-Solomon forward error correction.
+//   LL_COMPRESS: "lz" to ask for payload compression.
+//   LL_DUPLEX: set on both ends for full duplex, the file received by the transmitter and sent by the
+//              receiver, see applicationLayer.
+//   LL_ACK_EVERY: number of I frames the receiver answers with a single RR (default 1).
+//   LL_FLOW: "1" to ask for RNR flow control.
+// LL_STATS, the file the link statistics are written to on closing, is read by closeLinks.
+void readLinkOptions(LinkOptions *options)
+{
+    options->arqMode = ArqStopAndWait;
+    options->windowSize = 1;
+    options->fcsType = FcsXor;
+    options->framing = FramingStuffing;
+    options->fec = FecNone;
+    options->maxPayloadSize = MAX_PAYLOAD_SIZE;
+
+    const char *arq = getenv("LL_ARQ");
+    if (arq != NULL && strcmp(arq, "gbn") == 0)
+    {
+        options->arqMode = ArqGoBackN;
+        options->windowSize = MAX_WINDOW_SIZE;
+    }
+    else if (arq != NULL && strcmp(arq, "sr") == 0)
+    {
+        options->arqMode = ArqSelectiveRepeat;
+        options->windowSize = MAX_SR_WINDOW_SIZE;
+    }
+
+    const char *fcs = getenv("LL_FCS");
+    if (fcs != NULL && strcmp(fcs, "crc16") == 0)
+    {
+        options->fcsType = FcsCrc16;
+    }
+    else if (fcs != NULL && strcmp(fcs, "crc32") == 0)
+    {
+        options->fcsType = FcsCrc32;
+    }
+
+    const char *framing = getenv("LL_FRAMING");
+    if (framing != NULL && strcmp(framing, "cobs") == 0)
+    {
+        options->framing = FramingCobs;
+    }
+
+    const char *fec = getenv("LL_FEC");
+    if (fec != NULL && strcmp(fec, "rs") == 0)
+    {
+        options->fec = FecReedSolomon;
+    }
+
+    const char *compress = getenv("LL_COMPRESS");
+    options->compression = compress != NULL && strcmp(compress, "lz") == 0 ? CompressionLz : CompressionNone;
+
+    options->duplex = getenv("LL_DUPLEX") != NULL;
+
+    const char *window = getenv("LL_WINDOW");
+    if (window != NULL && options->arqMode != ArqStopAndWait)
+    {
+        options->windowSize = atoi(window);
+    }
+
+    const char *frameSize = getenv("LL_FRAME_SIZE");
+    if (frameSize != NULL)
+    {
+        options->maxPayloadSize = atoi(frameSize);
+    }
+
+    const char *adapt = getenv("LL_ADAPT");
+    options->fixedFrameSize = adapt != NULL && strcmp(adapt, "0") == 0;
+
+    const char *ackEvery = getenv("LL_ACK_EVERY");
+    options->ackEvery = ackEvery != NULL ? atoi(ackEvery) : 1;
+
+    const char *flow = getenv("LL_FLOW");
+    options->flowControl = flow != NULL && strcmp(flow, "0") != 0;
+}
+
+// Open the extra links listed in LL_BOND, serial ports separated by spaces that are bonded with the main one,
+// in the same order on both ends. Not by commas, which the names of pipe and shm ports have.
+// Returns -1 on error.
+int openBondedLinks(LinkLayer connectionParameters, LinkOptions options)
+{
+    bondedLinks[0] = &defaultLink;
+    bondedLinkCount = 1;
+
+    const char *bond = getenv("LL_BOND");
+    if (bond == NULL)
+    {
+        return 0;
+    }
+    char ports[256];
+    strncpy(ports, bond, sizeof(ports) - 1);
+    ports[sizeof(ports) - 1] = '\0';
+
+    for (char *port = strtok(ports, " \t"); port != NULL; port = strtok(NULL, " \t"))
+    {
+        if (bondedLinkCount == MAX_BOND_LINKS)
+        {
+            printf("At most %d links can be bonded!\n", MAX_BOND_LINKS);
+            return -1;
+        }
+        LinkContext *link = calloc(1, sizeof(LinkContext));
+        if (link == NULL)
+        {
+            return -1;
+        }
+        LinkLayer parameters = connectionParameters;
+        strncpy(parameters.serialPort, port, sizeof(parameters.serialPort) - 1);
+        parameters.serialPort[sizeof(parameters.serialPort) - 1] = '\0';
+        if (llsetoptionsCtx(link, options) < 0 || llopenCtx(link, parameters) < 0)
+        {
+            free(link);
+            return -1;
+        }
+        bondedLinks[bondedLinkCount++] = link;
+    }
+    return 0;
+}
+
+// Close the bonded links and then the main one, adding up their statistics and writing them to the file
+// named by LL_STATS, if any.
+void closeLinks(int showStatistics)
 {
-    if (frameCount == 0)
+    LinkStats stats[MAX_BOND_LINKS];
+    int count = bondedLinkCount > 0 ? bondedLinkCount : 1;
+    for (int i = 1; i < bondedLinkCount; i++)
     {
-        return 0.0;  // Avoid division by zero if no frames were sent
+        llcloseCtx(bondedLinks[i], showStatistics);
+        llgetstatsCtx(bondedLinks[i], &stats[i]);
+        free(bondedLinks[i]);
     }
+    bondedLinkCount = 0;
+    llclose(showStatistics);
+    llgetstats(&stats[0]);
 
-    // Calculate the average frame size in bits
-    double avgFrameSizeBytes = (double)totalFrameSize / frameCount;
-    double avgFrameSizeBits = avgFrameSizeBytes * 8;  // Convert to bits
-    return avgFrameSizeBits;
+    for (int i = 0; i < count; i++)
+    {
+        payloadBytes += stats[i].payloadBytesSent + stats[i].payloadBytesReceived;
+        frameTransmissions += stats[i].transmissions;
+        frameBytes += stats[i].frameBytesSent;
+    }
+    const char *path = getenv("LL_STATS");
+    if (path != NULL && exportStats(path, stats, count) < 0)
+    {
+        printf("Error writing the link statistics to %s!\n", path);
+    }
+}
+
+// Write the statistics of count links to path: as a JSON array if its name ends in .json, otherwise as
+// CSV rows appended to it, with the column names first when the file is new, so that runs pile up in one table.
+// Returns -1 on error.
+int exportStats(const char *path, const LinkStats *stats, int count)
+{
+    int length = strlen(path);
+    bool json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    FILE *file = fopen(path, json ? "w" : "a");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    bool header = !json && ftell(file) == 0;
+
+    int status = 0;
+    if (json)
+    {
+        fprintf(file, "[\n");
+    }
+    for (int i = 0; i < count && status == 0; i++)
+    {
+        if (json && i > 0)
+        {
+            fprintf(file, ",\n");
+        }
+        status = json ? statsWriteJson(&stats[i], file) : statsWriteCsv(&stats[i], file, header && i == 0);
+    }
+    if (json)
+    {
+        fprintf(file, "]\n");
+    }
+    return fclose(file) != 0 ? -1 : status;
 }
 
 int sendControlPacket(int controlValue, const char *filename, int fileSize)
@@ -202,10 +474,6 @@ int sendControlPacket(int controlValue, const char *filename, int fileSize)
     memcpy(&controlPacket[idx], filename, filenameLength);
     idx += filenameLength;
 
-    // Track the size of the control packet
-    totalFrameSize += packetSize;
-    frameCount++;
-
     // after building control packet, send it
     if (llwrite(controlPacket, idx) < 0)
     {
@@ -224,53 +492,62 @@ int sendDataPackets(FILE *file, int fileSize)
     int sequenceNumber = 0;
     int bytesRemaining = fileSize;
 
-    // temporary buffer to hold the data that each packet will send
-    unsigned char dataBuffer[MAX_PAYLOAD_SIZE];
-
-    // define the control field, which is 2 for data
-    dataBuffer[0] = 2;
-
     // loop through the file and keep sending packets until no more info left
     while (bytesRemaining > 0)
     {
-        // get chunk size, will be 995 until the remaining bytes are more than 0 and less than 995, then it becomes the remaining bytes
-        // 995 because we need a byte for C, S, L1 and L2 each, and one byte for bcc2 to be received in the end of the packet
-        int chunkSize = (bytesRemaining > MAX_PAYLOAD_SIZE - 5) ? MAX_PAYLOAD_SIZE - 5 : bytesRemaining;
-
-        // start filling the packet with idx
-        int idx = 1;
-
-        // define sequence number, and add 1 to it, with mod 100 for wrap around in case on more than 100 packets
-        dataBuffer[idx++] = sequenceNumber;
-        sequenceNumber = (sequenceNumber + 1) % 100;
-
-        // assuming chunk size is smaller than 65536, which it is since payload size is at max 1000
-        // get L1, which are 8 MSB of the size of the chunk 
-        dataBuffer[idx++] = (chunkSize >> 8) & 0xFF;
-        // and L2, 8 LSB of the size of the chunk
-        dataBuffer[idx++] = chunkSize & 0xFF;
-
-        // copy the data into the buffer, fread automatically reads the chunkSize ammount of chars into the data
-        int bytesRead = fread(&dataBuffer[idx], sizeof(unsigned char), chunkSize, file);
-        if (bytesRead != chunkSize) {
-            printf("Error reading from file.\n");
+        if (sendDataPacket(file, &bytesRemaining, &sequenceNumber) < 0)
+        {
             return -1;
         }
+    }
+    return 0;
+}
 
-        // Track the size of the data packet
-        totalFrameSize += idx + chunkSize;  // `idx` is the header size, `chunkSize` is the data size
-        frameCount++;
+// Send the next data packet of file, updating the bytes remaining and the packet sequence number.
+// Returns -1 on error.
+int sendDataPacket(FILE *file, int *bytesRemaining, int *sequenceNumber)
+{
+    // temporary buffer to hold the data that each packet will send
+    unsigned char dataBuffer[MAX_PAYLOAD_SIZE];
 
-        // send the packet
-        if (llwrite(dataBuffer, idx + chunkSize) < 0)
-        {
-            printf("Write error on send data packet!\n");
-            return -1;
-        }
-        
-        // update remaining bytes
-        bytesRemaining -= chunkSize;
+    // define the control field, which is 2 for data
+    dataBuffer[0] = 2;
+
+    // packets follow the payload size the link finds best for its error rate, llpayloadsize(), which changes
+    // as frames are lost; the chunk of file is that size less a byte for C, S, L1 and L2 each and one for
+    // bcc2, or the remaining bytes once fewer are left
+    int packetSize = llpayloadsize();
+    int chunkSize = (*bytesRemaining > packetSize - 5) ? packetSize - 5 : *bytesRemaining;
+
+    // start filling the packet with idx
+    int idx = 1;
+
+    // define sequence number, and add 1 to it, with mod 100 for wrap around in case on more than 100 packets
+    dataBuffer[idx++] = *sequenceNumber;
+    *sequenceNumber = (*sequenceNumber + 1) % 100;
+
+    // assuming chunk size is smaller than 65536, which it is since payload size is at max 1000
+    // get L1, which are 8 MSB of the size of the chunk 
+    dataBuffer[idx++] = (chunkSize >> 8) & 0xFF;
+    // and L2, 8 LSB of the size of the chunk
+    dataBuffer[idx++] = chunkSize & 0xFF;
+
+    // copy the data into the buffer, fread automatically reads the chunkSize ammount of chars into the data
+    int bytesRead = fread(&dataBuffer[idx], sizeof(unsigned char), chunkSize, file);
+    if (bytesRead != chunkSize) {
+        printf("Error reading from file.\n");
+        return -1;
+    }
+
+    // send the packet
+    if (llwrite(dataBuffer, idx + chunkSize) < 0)
+    {
+        printf("Write error on send data packet!\n");
+        return -1;
     }
+    
+    // update remaining bytes
+    *bytesRemaining -= chunkSize;
     return 0;
 }
 
@@ -309,42 +586,137 @@ int receiveDataPackets(const char *filename, int fileSize)
             continue;
         }
 
-        // check control value to see if it is correct
-        if (packet[0] != 2)
+        if (writeDataPacket(file, packet, &fileSize, &sequenceNumber) < 0)
         {
-            printf("Unexpected control field value.\n");
             fclose(file);
             return -1;
         }
+    }
+    return 0;
+}
 
-        // check the sequence number to ensure correct order
-        if(sequenceNumber != packet[1])
-        {
-            printf("Sequence number is incorrect! It is %d and should be %u!\n", sequenceNumber, packet[1]);
-            fclose(file);
-            return -1;
-        }
+// Write the data of a received data packet to file, updating the bytes still expected and the packet sequence number.
+// Returns -1 on error.
+int writeDataPacket(FILE *file, const unsigned char *packet, int *fileSize, int *sequenceNumber)
+{
+    // check control value to see if it is correct
+    if (packet[0] != 2)
+    {
+        printf("Unexpected control field value.\n");
+        return -1;
+    }
 
-        // maintain increment and wrap around logic for sequence number 
-        sequenceNumber = (sequenceNumber + 1) % 100;
+    // check the sequence number to ensure correct order
+    if(*sequenceNumber != packet[1])
+    {
+        printf("Sequence number is incorrect! It is %d and should be %u!\n", *sequenceNumber, packet[1]);
+        return -1;
+    }
 
-        // through L1 and L2, get the chunk size
-        int chunkSize = (packet[2] << 8) | packet[3];
+    // maintain increment and wrap around logic for sequence number 
+    *sequenceNumber = (*sequenceNumber + 1) % 100;
 
-        // write into the file the data components of the packet
-        if (fwrite(&packet[1 + 1 + 2], sizeof(unsigned char), chunkSize, file) != chunkSize)
+    // through L1 and L2, get the chunk size
+    int chunkSize = (packet[2] << 8) | packet[3];
+
+    // write into the file the data components of the packet
+    if (fwrite(&packet[1 + 1 + 2], sizeof(unsigned char), chunkSize, file) != chunkSize)
+    {
+        printf("Error writing to file.\n");
+        return -1;
+    }
+#ifdef LL_TEST_HOOKS
+    if (writeDelay > 0)
+    {
+        usleep(writeDelay * 1000);
+    }
+#endif
+    
+    *fileSize -= chunkSize;
+    if (*fileSize < 0)
+    {
+        printf("Oh no, received too much data!\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Full duplex: send the file sendName while writing the file the other end sends to receiveName.
+// Each end sends START, the data packets and END, and reads a packet of the other end after each one it sends,
+// the link queues what arrives in between and acknowledges it with the I frames going the other way.
+// Returns -1 on error.
+int exchangeFiles(const char *sendName, const char *receiveName)
+{
+    FILE *in = fopen(sendName, "rb");
+    if (in == NULL)
+    {
+        printf("Error opening file.\n");
+        return -1;
+    }
+    FILE *out = fopen(receiveName, "wb");
+    if (out == NULL)
+    {
+        printf("Error creating file.\n");
+        fclose(in);
+        return -1;
+    }
+    fseek(in, 0, SEEK_END);
+    int sendSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    bool startSent = FALSE;
+    bool sending = TRUE;
+    int bytesRemaining = sendSize;
+    int sendSequence = 0;
+    // the size of the incoming file comes with its START packet
+    bool receiving = TRUE;
+    int receiveSize = 0;
+    int receiveSequence = 0;
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    int result = 0;
+
+    while (result == 0 && (sending || receiving))
+    {
+        if (sending)
         {
-            printf("Error writing to file.\n");
-            fclose(file);
-            return -1;
+            if (!startSent)
+            {
+                result = sendControlPacket(1, sendName, sendSize);
+                startSent = TRUE;
+            }
+            else if (bytesRemaining > 0)
+            {
+                result = sendDataPacket(in, &bytesRemaining, &sendSequence);
+            }
+            else
+            {
+                result = sendControlPacket(3, sendName, sendSize);
+                sending = FALSE;
+            }
         }
-        
-        fileSize -= chunkSize;
-        if (fileSize < 0)
+        if (receiving && result == 0)
         {
-            printf("Oh no, received too much data!\n");
-            return -1;
+            if (llread(packet) < 0)
+            {
+                printf("Error reading the received packet!\n");
+                result = -1;
+            }
+            else if (packet[0] == 1)
+            {
+                memcpy(&receiveSize, &packet[1 + 2], sizeof(receiveSize));
+            }
+            else if (packet[0] == 3)
+            {
+                receiving = FALSE;
+            }
+            else
+            {
+                result = writeDataPacket(out, packet, &receiveSize, &receiveSequence);
+            }
         }
     }
-    return 0;
-}
\ No newline at end of file
+
+    fclose(in);
+    fclose(out);
+    return result;
+}
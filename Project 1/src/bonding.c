@@ -0,0 +1,275 @@
+// Link bonding implementation
+
+#include "bonding.h"
+#include "retransmission_timer.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// state shared by the threads of one bonded transfer, guarded by lock
+typedef struct
+{
+    pthread_mutex_t lock;
+    int fd; // file being sent or received
+    int fileSize;
+    int chunkSize;  // file bytes in a full data packet
+    int nextOffset; // first byte no link has taken yet
+    int count;
+    double goodput[MAX_BOND_LINKS]; // bytes per second each link delivered, 0 until measured
+    bool stopped[MAX_BOND_LINKS];   // link took its last chunk
+    bool failed;
+} BondState;
+
+typedef struct
+{
+    BondState *bond;
+    LinkContext *link;
+    int index;
+    long bytes; // file bytes this link carried
+    int status;
+} BondWorker;
+
+// Take the next chunk for link index, of at most size bytes, and return its size, or 0 when the link should stop.
+// The fastest link alone needs k + 1 chunk times for the k chunks left and the one it is sending,
+// so a link more than k + 1 times slower leaves the rest to it instead of holding back the end of the file.
+int takeChunk(BondState *bond, int index, int size, int *offset)
+{
+    int remaining = bond->fileSize - bond->nextOffset;
+    if (bond->failed || remaining <= 0)
+    {
+        return 0;
+    }
+    int chunkSize = remaining > bond->chunkSize ? bond->chunkSize : remaining;
+    int chunksLeft = (remaining + bond->chunkSize - 1) / bond->chunkSize;
+    // a noisy link takes smaller chunks
+    if (chunkSize > size)
+    {
+        chunkSize = size;
+    }
+
+    double fastest = 0;
+    for (int i = 0; i < bond->count; i++)
+    {
+        if (!bond->stopped[i] && bond->goodput[i] > fastest)
+        {
+            fastest = bond->goodput[i];
+        }
+    }
+    double own = bond->goodput[index];
+    if (own > 0 && fastest > (chunksLeft + 1) * own)
+    {
+        return 0;
+    }
+
+    *offset = bond->nextOffset;
+    bond->nextOffset += chunkSize;
+    return chunkSize;
+}
+
+// Sender thread of one link: send chunks until none is left for it, then the END packet.
+void *bondSender(void *arg)
+{
+    BondWorker *worker = arg;
+    BondState *bond = worker->bond;
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    long busyTime = 0;
+
+    while (TRUE)
+    {
+        int offset = 0;
+        pthread_mutex_lock(&bond->lock);
+        int chunkSize = takeChunk(bond, worker->index, llpayloadsizeCtx(worker->link) - BOND_HEADER_SIZE, &offset);
+        if (chunkSize == 0)
+        {
+            bond->stopped[worker->index] = TRUE;
+        }
+        pthread_mutex_unlock(&bond->lock);
+        if (chunkSize == 0)
+        {
+            break;
+        }
+
+        packet[0] = BOND_DATA_PACKET;
+        packet[1] = (offset >> 24) & 0xFF;
+        packet[2] = (offset >> 16) & 0xFF;
+        packet[3] = (offset >> 8) & 0xFF;
+        packet[4] = offset & 0xFF;
+        packet[5] = (chunkSize >> 8) & 0xFF;
+        packet[6] = chunkSize & 0xFF;
+        if (pread(bond->fd, packet + BOND_HEADER_SIZE, chunkSize, offset) != chunkSize)
+        {
+            printf("Error reading from file.\n");
+            worker->status = -1;
+            break;
+        }
+
+        long start = timerNow();
+        if (llwriteCtx(worker->link, packet, BOND_HEADER_SIZE + chunkSize) < 0)
+        {
+            printf("Write error on bonded link %d!\n", worker->index);
+            worker->status = -1;
+            break;
+        }
+        busyTime += timerNow() - start;
+        worker->bytes += chunkSize;
+
+        pthread_mutex_lock(&bond->lock);
+        bond->goodput[worker->index] = busyTime > 0 ? worker->bytes * 1000.0 / busyTime : 0;
+        pthread_mutex_unlock(&bond->lock);
+    }
+
+    pthread_mutex_lock(&bond->lock);
+    bond->stopped[worker->index] = TRUE;
+    if (worker->status < 0)
+    {
+        bond->failed = TRUE;
+    }
+    pthread_mutex_unlock(&bond->lock);
+
+    unsigned char end = 3;
+    if (worker->status == 0 && llwriteCtx(worker->link, &end, 1) < 0)
+    {
+        printf("Write error on END of bonded link %d!\n", worker->index);
+        worker->status = -1;
+    }
+    return NULL;
+}
+
+// Receiver thread of one link: write chunks in place until the END packet, or until another link failed.
+void *bondReceiver(void *arg)
+{
+    BondWorker *worker = arg;
+    BondState *bond = worker->bond;
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+
+    while (TRUE)
+    {
+        pthread_mutex_lock(&bond->lock);
+        bool failed = bond->failed;
+        pthread_mutex_unlock(&bond->lock);
+        if (failed)
+        {
+            break;
+        }
+
+        int packetSize = llreadCtx(worker->link, packet);
+        if (packetSize < 0)
+        {
+            printf("Error reading from bonded link %d!\n", worker->index);
+            worker->status = -1;
+            break;
+        }
+        // rejected frame, read again
+        if (packetSize == 0)
+        {
+            continue;
+        }
+        if (packet[0] == 3)
+        {
+            break;
+        }
+
+        int offset = (packet[1] << 24) | (packet[2] << 16) | (packet[3] << 8) | packet[4];
+        int chunkSize = (packet[5] << 8) | packet[6];
+        if (packet[0] != BOND_DATA_PACKET || packetSize != BOND_HEADER_SIZE + chunkSize ||
+            offset < 0 || offset + chunkSize > bond->fileSize)
+        {
+            printf("Unexpected packet on bonded link %d.\n", worker->index);
+            worker->status = -1;
+            break;
+        }
+        if (pwrite(bond->fd, packet + BOND_HEADER_SIZE, chunkSize, offset) != chunkSize)
+        {
+            printf("Error writing to file.\n");
+            worker->status = -1;
+            break;
+        }
+        worker->bytes += chunkSize;
+    }
+
+    if (worker->status < 0)
+    {
+        pthread_mutex_lock(&bond->lock);
+        bond->failed = TRUE;
+        pthread_mutex_unlock(&bond->lock);
+    }
+    return NULL;
+}
+
+// Run one thread per link and wait for all of them.
+// Returns -1 if any of them failed.
+int runBond(LinkContext **links, int count, FILE *file, int fileSize, void *(*thread)(void *))
+{
+    if (count < 1 || count > MAX_BOND_LINKS)
+    {
+        printf("Bonding needs between 1 and %d links!\n", MAX_BOND_LINKS);
+        return -1;
+    }
+
+    BondState bond;
+    memset(&bond, 0, sizeof(bond));
+    pthread_mutex_init(&bond.lock, NULL);
+    bond.fd = fileno(file);
+    bond.fileSize = fileSize;
+    bond.count = count;
+    bond.chunkSize = MAX_PAYLOAD_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        if (links[i]->maxPayloadSize < bond.chunkSize)
+        {
+            bond.chunkSize = links[i]->maxPayloadSize;
+        }
+    }
+    bond.chunkSize -= BOND_HEADER_SIZE;
+
+    BondWorker workers[MAX_BOND_LINKS];
+    pthread_t threads[MAX_BOND_LINKS];
+    int started = 0;
+    long start = timerNow();
+    for (; started < count; started++)
+    {
+        workers[started] = (BondWorker){.bond = &bond, .link = links[started], .index = started};
+        if (pthread_create(&threads[started], NULL, thread, &workers[started]) != 0)
+        {
+            printf("Error starting the thread of bonded link %d!\n", started);
+            break;
+        }
+    }
+
+    int status = started == count ? 0 : -1;
+    long bytes = 0;
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (workers[i].status < 0)
+        {
+            status = -1;
+        }
+        bytes += workers[i].bytes;
+    }
+    long elapsed = timerNow() - start;
+    pthread_mutex_destroy(&bond.lock);
+
+    for (int i = 0; i < started; i++)
+    {
+        printf("Bonded link %d carried %ld bytes\n", i, workers[i].bytes);
+    }
+    printf("%ld bytes over %d links in %ld ms\n", bytes, started, elapsed);
+    if (status == 0 && bytes != fileSize)
+    {
+        printf("Bonded transfer carried %ld bytes instead of %d!\n", bytes, fileSize);
+        return -1;
+    }
+    return status;
+}
+
+int bondSend(LinkContext **links, int count, FILE *file, int fileSize)
+{
+    return runBond(links, count, file, fileSize, bondSender);
+}
+
+int bondReceive(LinkContext **links, int count, FILE *file, int fileSize)
+{
+    return runBond(links, count, file, fileSize, bondReceiver);
+}
@@ -0,0 +1,149 @@
+// Link capabilities implementation
+
+#include "capabilities.h"
+#include "frame.h"
+#include "stuffing.h"
+#include <stddef.h>
+
+int capabilityFrame(unsigned char control, const LinkOptions *options, unsigned char *frame)
+{
+    frame[0] = FLAG;
+    frame[1] = A_T;
+    frame[2] = control;
+    frame[3] = frame[1] ^ frame[2];
+
+    unsigned char block[MAX_CAPABILITY_SIZE + MAX_FCS_SIZE];
+    int size = 0;
+    block[size++] = CAP_PAYLOAD_SIZE;
+    block[size++] = 2;
+    block[size++] = (options->maxPayloadSize >> 8) & 0xFF;
+    block[size++] = options->maxPayloadSize & 0xFF;
+    block[size++] = CAP_WINDOW;
+    block[size++] = 2;
+    block[size++] = options->arqMode;
+    block[size++] = options->windowSize;
+    block[size++] = CAP_FCS;
+    block[size++] = 1;
+    block[size++] = options->fcsType;
+    block[size++] = CAP_FRAMING;
+    block[size++] = 1;
+    block[size++] = options->framing;
+    block[size++] = CAP_COMPRESSION;
+    block[size++] = 1;
+    block[size++] = options->compression;
+    block[size++] = CAP_FEC;
+    block[size++] = 1;
+    block[size++] = options->fec;
+    block[size++] = CAP_DUPLEX;
+    block[size++] = 1;
+    block[size++] = options->duplex;
+    block[size++] = CAP_FLOW_CONTROL;
+    block[size++] = 1;
+    block[size++] = options->flowControl;
+    size += fcsWrite(CAPABILITY_FCS, fcsCompute(CAPABILITY_FCS, block, size), block + size);
+
+    int escapes = 0;
+    int idx = 4 + stuffBytes(frame + 4, block, size, CAPABILITY_FCS, NULL, &escapes);
+    frame[idx++] = FLAG;
+    return idx;
+}
+
+int capabilitiesRead(const unsigned char *data, int size, LinkOptions *options)
+{
+    options->arqMode = ArqStopAndWait;
+    options->windowSize = 1;
+    options->fcsType = FcsXor;
+    options->framing = FramingStuffing;
+    options->fec = FecNone;
+    options->compression = CompressionNone;
+    options->duplex = FALSE;
+    options->flowControl = FALSE;
+    options->maxPayloadSize = MAX_PAYLOAD_SIZE;
+    options->fixedFrameSize = FALSE;
+    options->ackEvery = 1;
+
+    int i = 0;
+    while (i + 2 <= size)
+    {
+        int tag = data[i];
+        int length = data[i + 1];
+        const unsigned char *value = data + i + 2;
+        i += 2 + length;
+        if (i > size)
+        {
+            return -1;
+        }
+
+        if (tag == CAP_PAYLOAD_SIZE && length == 2)
+        {
+            options->maxPayloadSize = (value[0] << 8) | value[1];
+        }
+        else if (tag == CAP_WINDOW && length == 2)
+        {
+            options->arqMode = value[0];
+            options->windowSize = value[1];
+        }
+        else if (tag == CAP_FCS && length == 1)
+        {
+            options->fcsType = value[0];
+        }
+        else if (tag == CAP_FRAMING && length == 1)
+        {
+            options->framing = value[0];
+        }
+        else if (tag == CAP_COMPRESSION && length == 1)
+        {
+            options->compression = value[0];
+        }
+        else if (tag == CAP_FEC && length == 1)
+        {
+            options->fec = value[0];
+        }
+        else if (tag == CAP_DUPLEX && length == 1)
+        {
+            options->duplex = value[0] != 0;
+        }
+        else if (tag == CAP_FLOW_CONTROL && length == 1)
+        {
+            options->flowControl = value[0] != 0;
+        }
+    }
+    if (i != size)
+    {
+        return -1;
+    }
+
+    if (options->maxPayloadSize < MIN_PAYLOAD_SIZE || options->maxPayloadSize > MAX_PAYLOAD_SIZE)
+    {
+        return -1;
+    }
+    int maxWindowSize = options->arqMode == ArqGoBackN ? MAX_WINDOW_SIZE : options->arqMode == ArqSelectiveRepeat ? MAX_SR_WINDOW_SIZE : 1;
+    if (options->arqMode > ArqSelectiveRepeat || options->windowSize < 1 || options->windowSize > maxWindowSize ||
+        (options->duplex && options->arqMode == ArqStopAndWait))
+    {
+        return -1;
+    }
+    if (options->fcsType > FcsCrc32 || options->framing > FramingCobs || options->fec > FecReedSolomon ||
+        options->compression > CompressionLz)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void capabilitiesAgree(const LinkOptions *offer, const LinkOptions *own, LinkOptions *agreed)
+{
+    agreed->maxPayloadSize = offer->maxPayloadSize < own->maxPayloadSize ? offer->maxPayloadSize : own->maxPayloadSize;
+    agreed->arqMode = offer->arqMode;
+    agreed->windowSize = offer->windowSize;
+    // the XOR, CRC-16 and CRC-32 come in order of strength
+    agreed->fcsType = offer->fcsType > own->fcsType ? offer->fcsType : own->fcsType;
+    agreed->framing = offer->framing;
+    agreed->fec = offer->fec > own->fec ? offer->fec : own->fec;
+    // an end that did not ask for compression may not have the codec, older ones always offered none
+    agreed->compression = offer->compression == own->compression ? offer->compression : CompressionNone;
+    agreed->duplex = offer->duplex && own->duplex;
+    agreed->flowControl = offer->flowControl && own->flowControl;
+    agreed->fixedFrameSize = own->fixedFrameSize;
+    agreed->ackEvery = own->ackEvery;
+}
@@ -0,0 +1,57 @@
+// Consistent Overhead Byte Stuffing implementation
+
+#include "cobs.h"
+#include "frame.h"
+#include <string.h>
+
+// Close the open block, its code being the distance to the next code byte, and open a new one.
+void closeBlock(CobsEncoder *encoder)
+{
+    encoder->out[encoder->code] = (encoder->size - encoder->code) ^ FLAG;
+    encoder->code = encoder->size++;
+}
+
+void cobsStart(CobsEncoder *encoder, unsigned char *out)
+{
+    encoder->out = out;
+    encoder->code = 0;
+    encoder->size = 1;
+}
+
+void cobsUpdate(CobsEncoder *encoder, const unsigned char *data, int size)
+{
+    int i = 0;
+    while (i < size)
+    {
+        // a full block ends without a zero, code 0xFF
+        int room = COBS_BLOCK_SIZE - (encoder->size - encoder->code - 1);
+        if (room == 0)
+        {
+            closeBlock(encoder);
+            continue;
+        }
+
+        // copy the run of non-zero bytes that fits in the block, a zero ends the block
+        int span = size - i < room ? size - i : room;
+        const unsigned char *zero = memchr(data + i, 0, span);
+        int run = zero != NULL ? zero - (data + i) : span;
+        unsigned char *out = encoder->out + encoder->size;
+        for (int j = 0; j < run; j++)
+        {
+            out[j] = data[i + j] ^ FLAG;
+        }
+        encoder->size += run;
+        i += run;
+        if (zero != NULL)
+        {
+            closeBlock(encoder);
+            i++;
+        }
+    }
+}
+
+int cobsFinish(CobsEncoder *encoder)
+{
+    encoder->out[encoder->code] = (encoder->size - encoder->code) ^ FLAG;
+    return encoder->size;
+}
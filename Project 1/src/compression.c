@@ -0,0 +1,185 @@
+// Payload compression implementation
+
+#include "compression.h"
+#include <stdint.h>
+#include <string.h>
+
+// positions of earlier 4-byte strings are looked up in a table of 2^LZ_HASH_BITS entries
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+// a sequence starts with a token, the literal count in the high nibble and the copy length minus
+// LZ_MIN_MATCH in the low one, either being continued by more bytes when the nibble is 15
+#define LZ_NIBBLE_MAX 15
+
+uint32_t lzRead32(const unsigned char *data)
+{
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+int lzHash(uint32_t word)
+{
+    return (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Bytes a length takes after its nibble.
+int lengthBytes(int length)
+{
+    return length < LZ_NIBBLE_MAX ? 0 : (length - LZ_NIBBLE_MAX) / 255 + 1;
+}
+
+// Write the bytes continuing a length whose nibble is full.
+int writeLength(unsigned char *out, int length)
+{
+    int idx = 0;
+    for (length -= LZ_NIBBLE_MAX; length >= 255; length -= 255)
+    {
+        out[idx++] = 255;
+    }
+    out[idx++] = length;
+    return idx;
+}
+
+// Write a sequence of count literals, followed by a copy of length bytes from offset back unless length is 0,
+// which ends the data.
+// Returns the index after the sequence, or -1 if it does not fit in capacity.
+int writeSequence(unsigned char *out, int idx, int capacity, const unsigned char *literals, int count, int offset, int length)
+{
+    int match = length > 0 ? length - LZ_MIN_MATCH : 0;
+    int needed = 1 + lengthBytes(count) + count + (length > 0 ? 2 + lengthBytes(match) : 0);
+    if (idx + needed > capacity)
+    {
+        return -1;
+    }
+
+    out[idx++] = (count < LZ_NIBBLE_MAX ? count : LZ_NIBBLE_MAX) << 4 | (match < LZ_NIBBLE_MAX ? match : LZ_NIBBLE_MAX);
+    if (count >= LZ_NIBBLE_MAX)
+    {
+        idx += writeLength(out + idx, count);
+    }
+    memcpy(out + idx, literals, count);
+    idx += count;
+    if (length > 0)
+    {
+        out[idx++] = offset >> 8;
+        out[idx++] = offset & 0xFF;
+        if (match >= LZ_NIBBLE_MAX)
+        {
+            idx += writeLength(out + idx, match);
+        }
+    }
+    return idx;
+}
+
+int lzCompress(const unsigned char *data, int size, unsigned char *out, int capacity)
+{
+    if (size > LZ_MAX_SIZE)
+    {
+        return -1;
+    }
+    // position + 1 of the last string with each hash, 0 for none
+    uint16_t table[LZ_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    int idx = 0;
+    int anchor = 0;
+    int in = 0;
+    while (in + LZ_MIN_MATCH <= size)
+    {
+        // the literals alone no longer fit
+        if (in - anchor >= capacity)
+        {
+            return -1;
+        }
+        uint32_t word = lzRead32(data + in);
+        int hash = lzHash(word);
+        int candidate = table[hash] - 1;
+        table[hash] = in + 1;
+        if (candidate < 0 || lzRead32(data + candidate) != word)
+        {
+            // the longer it goes without a match, the more positions are skipped, so that data which does not
+            // compress is given up on quickly
+            in += 1 + ((in - anchor) >> 6);
+            continue;
+        }
+
+        int length = LZ_MIN_MATCH;
+        while (in + length < size && data[candidate + length] == data[in + length])
+        {
+            length++;
+        }
+        idx = writeSequence(out, idx, capacity, data + anchor, in - anchor, in - candidate, length);
+        if (idx < 0)
+        {
+            return -1;
+        }
+        in += length;
+        anchor = in;
+    }
+    return writeSequence(out, idx, capacity, data + anchor, size - anchor, 0, 0);
+}
+
+// Read the bytes continuing a length whose nibble is full, from data[*in] on.
+// Returns the length, or -1 if the data ends first.
+int readLength(const unsigned char *data, int size, int *in, int nibble)
+{
+    int length = nibble;
+    if (nibble < LZ_NIBBLE_MAX)
+    {
+        return length;
+    }
+    int byte = 255;
+    while (byte == 255)
+    {
+        if (*in >= size || length > LZ_MAX_SIZE)
+        {
+            return -1;
+        }
+        byte = data[(*in)++];
+        length += byte;
+    }
+    return length;
+}
+
+int lzDecompress(const unsigned char *data, int size, unsigned char *out, int capacity)
+{
+    int in = 0;
+    int idx = 0;
+    while (in < size)
+    {
+        int token = data[in++];
+        int count = readLength(data, size, &in, token >> 4);
+        if (count < 0 || count > size - in || count > capacity - idx)
+        {
+            return -1;
+        }
+        memcpy(out + idx, data + in, count);
+        in += count;
+        idx += count;
+        // the last sequence has no copy
+        if (in == size)
+        {
+            return idx;
+        }
+
+        if (size - in < 2)
+        {
+            return -1;
+        }
+        int offset = data[in] << 8 | data[in + 1];
+        in += 2;
+        int length = readLength(data, size, &in, token & LZ_NIBBLE_MAX);
+        if (length < 0 || offset == 0 || offset > idx || length + LZ_MIN_MATCH > capacity - idx)
+        {
+            return -1;
+        }
+        // byte by byte, a copy may overlap what it writes, e.g. a run of one byte has offset 1
+        length += LZ_MIN_MATCH;
+        for (int i = 0; i < length; i++)
+        {
+            out[idx + i] = out[idx + i - offset];
+        }
+        idx += length;
+    }
+    return -1;
+}
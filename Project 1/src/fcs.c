@@ -0,0 +1,135 @@
+// Frame check sequence implementation
+
+#include "fcs.h"
+#include <pthread.h>
+
+// reflected polynomials
+#define CRC16_POLY 0x8408
+#define CRC32_POLY 0xEDB88320
+
+// slicing-by-8 tables: entry [k][b] is the crc of byte b followed by k zero bytes
+uint32_t crc16Table[8][256];
+uint32_t crc32Table[8][256];
+// built once, the first frame of any link may be sent from a bonding thread
+pthread_once_t crcTablesOnce = PTHREAD_ONCE_INIT;
+
+void buildCrcTable(uint32_t table[8][256], uint32_t poly)
+{
+    for (int b = 0; b < 256; b++)
+    {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        }
+        table[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++)
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+        }
+    }
+}
+
+void buildCrcTables()
+{
+    buildCrcTable(crc16Table, CRC16_POLY);
+    buildCrcTable(crc32Table, CRC32_POLY);
+}
+
+// Reflected crc update, eight bytes per step. Works for both widths since the
+// 16 bit crc keeps its upper bits clear.
+uint32_t crcUpdate(uint32_t table[8][256], uint32_t crc, const unsigned char *data, int size)
+{
+    while (size >= 8)
+    {
+        uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+              table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][data[4]] ^ table[2][data[5]] ^
+              table[1][data[6]] ^ table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+int fcsSize(FcsType type)
+{
+    switch (type)
+    {
+        case FcsCrc16: return 2;
+        case FcsCrc32: return 4;
+        default: return 1;
+    }
+}
+
+uint32_t fcsStart(FcsType type)
+{
+    pthread_once(&crcTablesOnce, buildCrcTables);
+
+    switch (type)
+    {
+        case FcsCrc16: return 0xFFFF;
+        case FcsCrc32: return 0xFFFFFFFF;
+        default: return 0;
+    }
+}
+
+uint32_t fcsUpdate(FcsType type, uint32_t fcs, const unsigned char *data, int size)
+{
+    switch (type)
+    {
+        case FcsCrc16:
+            return crcUpdate(crc16Table, fcs, data, size);
+        case FcsCrc32:
+            return crcUpdate(crc32Table, fcs, data, size);
+        default:
+            for (int i = 0; i < size; i++)
+            {
+                fcs ^= data[i];
+            }
+            return fcs;
+    }
+}
+
+uint32_t fcsFinish(FcsType type, uint32_t fcs)
+{
+    switch (type)
+    {
+        case FcsCrc16: return fcs ^ 0xFFFF;
+        case FcsCrc32: return fcs ^ 0xFFFFFFFF;
+        default: return fcs;
+    }
+}
+
+uint32_t fcsCompute(FcsType type, const unsigned char *data, int size)
+{
+    return fcsFinish(type, fcsUpdate(type, fcsStart(type), data, size));
+}
+
+int fcsWrite(FcsType type, uint32_t fcs, unsigned char *out)
+{
+    int size = fcsSize(type);
+    for (int i = 0; i < size; i++)
+    {
+        out[i] = (fcs >> (8 * i)) & 0xFF;
+    }
+    return size;
+}
+
+uint32_t fcsRead(FcsType type, const unsigned char *in)
+{
+    uint32_t fcs = 0;
+    for (int i = fcsSize(type) - 1; i >= 0; i--)
+    {
+        fcs = (fcs << 8) | in[i];
+    }
+    return fcs;
+}
@@ -0,0 +1,273 @@
+// Forward error correction implementation
+
+#include "fec.h"
+#include <pthread.h>
+#include <string.h>
+
+// GF(256) built on the primitive polynomial x^8 + x^4 + x^3 + x^2 + 1, with alpha = 2
+#define FEC_POLYNOMIAL 0x11D
+#define FEC_MAX_ERRORS (FEC_PARITY_SIZE / 2)
+
+unsigned char gfExp[2 * 255];
+unsigned char gfLog[256];
+// gfGenMul[j][x] is x times the coefficient of the encoder register stage j,
+// gfSynMul[j][x] is x times alpha^j, for the syndromes
+unsigned char gfGenMul[FEC_PARITY_SIZE][256];
+unsigned char gfSynMul[FEC_PARITY_SIZE][256];
+pthread_once_t fecTablesOnce = PTHREAD_ONCE_INIT;
+
+unsigned char gfMul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+unsigned char gfDiv(unsigned char a, unsigned char b)
+{
+    if (a == 0)
+    {
+        return 0;
+    }
+    return gfExp[gfLog[a] + 255 - gfLog[b]];
+}
+
+// alpha^power for any power, negative ones included
+unsigned char gfPow(int power)
+{
+    power %= 255;
+    return gfExp[power < 0 ? power + 255 : power];
+}
+
+void buildFecTables()
+{
+    int x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        gfExp[i] = x;
+        gfExp[i + 255] = x;
+        gfLog[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+        {
+            x ^= FEC_POLYNOMIAL;
+        }
+    }
+
+    // generator g(x) = (x - alpha^0) (x - alpha^1) ... (x - alpha^31), generator[k] the coefficient of x^k
+    unsigned char generator[FEC_PARITY_SIZE + 1] = {1};
+    for (int i = 0; i < FEC_PARITY_SIZE; i++)
+    {
+        for (int k = i + 1; k > 0; k--)
+        {
+            generator[k] = generator[k - 1] ^ gfMul(generator[k], gfExp[i]);
+        }
+        generator[0] = gfMul(generator[0], gfExp[i]);
+    }
+
+    for (int j = 0; j < FEC_PARITY_SIZE; j++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            gfGenMul[j][v] = gfMul(v, generator[FEC_PARITY_SIZE - 1 - j]);
+            gfSynMul[j][v] = gfMul(v, gfExp[j]);
+        }
+    }
+}
+
+// Data bytes in block b when size data bytes are split evenly into blocks of at most FEC_DATA_SIZE.
+int blockDataSize(int size, int blocks, int b)
+{
+    return size / blocks + (b < size % blocks ? 1 : 0);
+}
+
+int fecEncode(const unsigned char *data, int size, unsigned char *out)
+{
+    pthread_once(&fecTablesOnce, buildFecTables);
+
+    int blocks = (size + FEC_DATA_SIZE - 1) / FEC_DATA_SIZE;
+    int idx = 0;
+    for (int b = 0; b < blocks; b++)
+    {
+        int dataSize = blockDataSize(size, blocks, b);
+        memcpy(out + idx, data, dataSize);
+
+        // the parity is the remainder of data(x) x^32 divided by g(x), its highest coefficient first
+        unsigned char parity[FEC_PARITY_SIZE] = {0};
+        for (int i = 0; i < dataSize; i++)
+        {
+            unsigned char feedback = data[i] ^ parity[0];
+            for (int j = 0; j < FEC_PARITY_SIZE - 1; j++)
+            {
+                parity[j] = parity[j + 1] ^ gfGenMul[j][feedback];
+            }
+            parity[FEC_PARITY_SIZE - 1] = gfGenMul[FEC_PARITY_SIZE - 1][feedback];
+        }
+        memcpy(out + idx + dataSize, parity, FEC_PARITY_SIZE);
+
+        data += dataSize;
+        idx += dataSize + FEC_PARITY_SIZE;
+    }
+    return idx;
+}
+
+// Correct the size bytes of a codeword in place, byte i being the coefficient of x^(size - 1 - i).
+// Returns the number of corrected bytes, or -1 if there are too many errors.
+int decodeBlock(unsigned char *block, int size)
+{
+    unsigned char syndromes[FEC_PARITY_SIZE] = {0};
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < FEC_PARITY_SIZE; j++)
+        {
+            syndromes[j] = gfSynMul[j][syndromes[j]] ^ block[i];
+        }
+    }
+    unsigned char any = 0;
+    for (int j = 0; j < FEC_PARITY_SIZE; j++)
+    {
+        any |= syndromes[j];
+    }
+    if (any == 0)
+    {
+        return 0;
+    }
+
+    // Berlekamp-Massey: the error locator lambda(x), whose roots are the inverses of the error locations
+    unsigned char lambda[FEC_PARITY_SIZE + 1] = {1};
+    unsigned char previous[FEC_PARITY_SIZE + 1] = {1};
+    int errors = 0;
+    int shift = 1;
+    unsigned char previousDiscrepancy = 1;
+    for (int r = 0; r < FEC_PARITY_SIZE; r++)
+    {
+        unsigned char discrepancy = syndromes[r];
+        for (int i = 1; i <= errors; i++)
+        {
+            discrepancy ^= gfMul(lambda[i], syndromes[r - i]);
+        }
+        if (discrepancy == 0)
+        {
+            shift++;
+            continue;
+        }
+
+        unsigned char saved[FEC_PARITY_SIZE + 1];
+        memcpy(saved, lambda, sizeof(saved));
+        unsigned char scale = gfDiv(discrepancy, previousDiscrepancy);
+        for (int i = 0; i + shift <= FEC_PARITY_SIZE; i++)
+        {
+            lambda[i + shift] ^= gfMul(scale, previous[i]);
+        }
+        if (2 * errors <= r)
+        {
+            errors = r + 1 - errors;
+            memcpy(previous, saved, sizeof(previous));
+            previousDiscrepancy = discrepancy;
+            shift = 1;
+        }
+        else
+        {
+            shift++;
+        }
+    }
+    if (errors > FEC_MAX_ERRORS)
+    {
+        return -1;
+    }
+
+    // omega(x) = syndromes(x) lambda(x) mod x^32, the error evaluator
+    unsigned char omega[FEC_PARITY_SIZE] = {0};
+    for (int i = 0; i < FEC_PARITY_SIZE; i++)
+    {
+        for (int k = 0; k <= errors && k <= i; k++)
+        {
+            omega[i] ^= gfMul(lambda[k], syndromes[i - k]);
+        }
+    }
+
+    // Chien search over the positions the shortened block has, and Forney for the error values
+    int found = 0;
+    unsigned char positions[FEC_MAX_ERRORS];
+    unsigned char values[FEC_MAX_ERRORS];
+    for (int i = 0; i < size && found <= errors; i++)
+    {
+        int power = size - 1 - i;
+        unsigned char inverse = gfPow(-power);
+        unsigned char sum = 0;
+        unsigned char derivative = 0;
+        unsigned char x = 1;
+        for (int k = 0; k <= errors; k++)
+        {
+            unsigned char term = gfMul(lambda[k], x);
+            sum ^= term;
+            if (k & 1)
+            {
+                // the odd terms of lambda'(x) are those of lambda(x) over x, the even ones cancel out
+                derivative ^= gfMul(lambda[k], gfDiv(x, inverse));
+            }
+            x = gfMul(x, inverse);
+        }
+        if (sum != 0)
+        {
+            continue;
+        }
+        if (found == errors || derivative == 0)
+        {
+            return -1;
+        }
+
+        unsigned char evaluated = 0;
+        x = 1;
+        for (int k = 0; k < FEC_PARITY_SIZE; k++)
+        {
+            evaluated ^= gfMul(omega[k], x);
+            x = gfMul(x, inverse);
+        }
+        positions[found] = i;
+        values[found] = gfMul(gfPow(power), gfDiv(evaluated, derivative));
+        found++;
+    }
+    // a locator without as many roots in the block means more errors than it can describe
+    if (found != errors)
+    {
+        return -1;
+    }
+
+    for (int e = 0; e < found; e++)
+    {
+        block[positions[e]] ^= values[e];
+    }
+    return found;
+}
+
+int fecDecode(unsigned char *data, int size, int *corrected)
+{
+    pthread_once(&fecTablesOnce, buildFecTables);
+
+    int blocks = (size + FEC_BLOCK_SIZE - 1) / FEC_BLOCK_SIZE;
+    int dataSize = size - blocks * FEC_PARITY_SIZE;
+    if (dataSize <= 0)
+    {
+        return size == 0 ? 0 : -1;
+    }
+
+    int in = 0;
+    int out = 0;
+    for (int b = 0; b < blocks; b++)
+    {
+        int blockSize = blockDataSize(dataSize, blocks, b);
+        int fixed = decodeBlock(data + in, blockSize + FEC_PARITY_SIZE);
+        if (fixed < 0)
+        {
+            return -1;
+        }
+        *corrected += fixed;
+        memmove(data + out, data + in, blockSize);
+        in += blockSize + FEC_PARITY_SIZE;
+        out += blockSize;
+    }
+    return out;
+}
@@ -0,0 +1,321 @@
+// Frame decoder implementation
+
+#include "frame_decoder.h"
+#include "capabilities.h"
+#include "frame.h"
+#include "stuffing.h"
+#include <string.h>
+
+void decoderInit(FrameDecoder *decoder, unsigned char *payload, int capacity, FcsType fcsType, int seqModulus)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->state = DecodeHunt;
+    decoder->payload = payload;
+    decoder->capacity = capacity;
+    decoder->fcsType = fcsType;
+    memset(decoder->controlAcks, -1, sizeof(decoder->controlAcks));
+
+    decoder->controlTypes[SET] = FrameSet;
+    decoder->controlTypes[UA] = FrameUa;
+    decoder->controlTypes[DISC] = FrameDisc;
+    for (int n = 0; n < seqModulus; n++)
+    {
+        decoder->controlTypes[C_RR(n)] = FrameRr;
+        decoder->controlSequences[C_RR(n)] = n;
+        decoder->controlTypes[C_REJ(n)] = FrameRej;
+        decoder->controlSequences[C_REJ(n)] = n;
+        decoder->controlTypes[C_RNR(n)] = FrameRnr;
+        decoder->controlSequences[C_RNR(n)] = n;
+        decoder->controlTypes[C_I(n)] = FrameI;
+        decoder->controlSequences[C_I(n)] = n;
+    }
+}
+
+void decoderSetFraming(FrameDecoder *decoder, FramingMode framing)
+{
+    decoder->framing = framing;
+}
+
+void decoderSetFec(FrameDecoder *decoder, FecMode fec)
+{
+    decoder->fec = fec;
+}
+
+void decoderSetCompression(FrameDecoder *decoder, CompressionMode compression)
+{
+    decoder->compression = compression;
+}
+
+void decoderSetDuplex(FrameDecoder *decoder)
+{
+    for (int n = 0; n < SEQ_BITS_MODULUS; n++)
+    {
+        for (int r = 0; r < SEQ_BITS_MODULUS; r++)
+        {
+            decoder->controlTypes[C_I_ACK(n, r)] = FrameI;
+            decoder->controlSequences[C_I_ACK(n, r)] = n;
+            decoder->controlAcks[C_I_ACK(n, r)] = r;
+        }
+    }
+}
+
+// Fold into the frame check sequence the payload bytes that cannot be part of the received one.
+void foldPayload(FrameDecoder *decoder)
+{
+    int end = decoder->size - decoder->frameFcsSize;
+    if (end > decoder->checked && !decoder->fecFrame)
+    {
+        decoder->fcs = fcsUpdate(decoder->frameFcsType, decoder->fcs, decoder->payload + decoder->checked, end - decoder->checked);
+        decoder->checked = end;
+    }
+}
+
+// Start the payload of an I frame, or the capability block of a SET or UA, checked with fcsType.
+void startPayload(FrameDecoder *decoder, FcsType fcsType)
+{
+    decoder->frameFcsType = fcsType;
+    decoder->frameFcsSize = fcsSize(fcsType);
+    decoder->fcs = fcsStart(fcsType);
+    decoder->checked = 0;
+    decoder->fecFrame = FALSE;
+}
+
+// Fill the event for the frame that just ended.
+void finishFrame(FrameDecoder *decoder, FrameEvent *event)
+{
+    event->type = decoder->controlTypes[decoder->control];
+    event->address = decoder->address & ~A_COMPRESSED;
+    event->compressed = (decoder->address & A_COMPRESSED) != 0;
+    event->sequence = decoder->controlSequences[decoder->control];
+    event->ack = decoder->controlAcks[decoder->control];
+    event->payloadSize = 0;
+    event->valid = TRUE;
+
+    if (decoder->size > 0)
+    {
+        // forward error correction comes off first, the check sequence is over the corrected bytes
+        if (decoder->fecFrame)
+        {
+            int size = fecDecode(decoder->payload, decoder->size, &decoder->fecCorrected);
+            if (size <= decoder->frameFcsSize)
+            {
+                decoder->fecFailures++;
+                event->valid = FALSE;
+                return;
+            }
+            decoder->size = size;
+            decoder->fcs = fcsUpdate(decoder->frameFcsType, decoder->fcs, decoder->payload, size - decoder->frameFcsSize);
+        }
+        event->payloadSize = decoder->size - decoder->frameFcsSize;
+        uint32_t received = fcsRead(decoder->frameFcsType, decoder->payload + event->payloadSize);
+        event->valid = fcsFinish(decoder->frameFcsType, decoder->fcs) == received;
+        if (!event->valid)
+        {
+            decoder->fcsErrors++;
+        }
+    }
+}
+
+int decodeBytes(FrameDecoder *decoder, const unsigned char *data, int size, FrameEvent *event)
+{
+    event->type = FrameNone;
+    int i = 0;
+    while (i < size)
+    {
+        // copy the run of plain payload bytes in one go
+        if (decoder->state == DecodeData)
+        {
+            int room = decoder->capacity - decoder->size;
+            int run = 0;
+            if (data[i] != FLAG && data[i] != ESC)
+            {
+                run = findSpecial(data + i, size - i < room ? size - i : room);
+            }
+            if (run > 0)
+            {
+                memcpy(decoder->payload + decoder->size, data + i, run);
+                decoder->size += run;
+                i += run;
+                foldPayload(decoder);
+                continue;
+            }
+        }
+        // same for the rest of a COBS block, up to a FLAG
+        else if (decoder->state == DecodeCobs && decoder->cobsLeft > 0)
+        {
+            int room = decoder->capacity - decoder->size;
+            int limit = size - i;
+            limit = limit < decoder->cobsLeft ? limit : decoder->cobsLeft;
+            limit = limit < room ? limit : room;
+            int run = 0;
+            unsigned char *out = decoder->payload + decoder->size;
+            while (run < limit && data[i + run] != FLAG)
+            {
+                out[run] = data[i + run] ^ FLAG;
+                run++;
+            }
+            if (run > 0)
+            {
+                decoder->size += run;
+                decoder->cobsLeft -= run;
+                i += run;
+                foldPayload(decoder);
+                continue;
+            }
+        }
+
+        unsigned char byte = data[i++];
+        switch (decoder->state)
+        {
+            case DecodeHunt:
+                if (byte == FLAG)
+                {
+                    decoder->state = DecodeAddress;
+                }
+                break;
+            case DecodeAddress:
+            {
+                unsigned char address = decoder->compression != CompressionNone ? byte & ~A_COMPRESSED : byte;
+                if (address == A_T || address == A_R)
+                {
+                    decoder->address = byte;
+                    decoder->state = DecodeControl;
+                }
+                else if (byte != FLAG)
+                {
+                    decoder->state = DecodeHunt;
+                }
+                break;
+            }
+            case DecodeControl:
+                // only I frames can be compressed
+                if (decoder->controlTypes[byte] != FrameNone &&
+                    (!(decoder->address & A_COMPRESSED) || decoder->controlTypes[byte] == FrameI))
+                {
+                    decoder->control = byte;
+                    decoder->state = DecodeBcc1;
+                }
+                else
+                {
+                    decoder->state = byte == FLAG ? DecodeAddress : DecodeHunt;
+                }
+                break;
+            case DecodeBcc1:
+                if (byte == (decoder->address ^ decoder->control))
+                {
+                    decoder->size = 0;
+                    if (decoder->controlTypes[decoder->control] == FrameI)
+                    {
+                        startPayload(decoder, decoder->fcsType);
+                        decoder->fecFrame = decoder->fec != FecNone;
+                        decoder->cobsLeft = 0;
+                        decoder->cobsZero = FALSE;
+                        decoder->state = decoder->framing == FramingCobs ? DecodeCobs : DecodeData;
+                    }
+                    else
+                    {
+                        decoder->state = DecodeClose;
+                    }
+                }
+                else if (byte == FLAG)
+                {
+                    decoder->state = DecodeAddress;
+                }
+                else
+                {
+                    decoder->bcc1Errors++;
+                    decoder->state = DecodeHunt;
+                }
+                break;
+            case DecodeClose:
+                if (byte == FLAG)
+                {
+                    decoder->state = DecodeAddress;
+                    finishFrame(decoder, event);
+                    return i;
+                }
+                // SET and UA may carry a capability block, always byte stuffed, read it from this byte on
+                if (decoder->control == SET || decoder->control == UA)
+                {
+                    startPayload(decoder, CAPABILITY_FCS);
+                    decoder->state = DecodeData;
+                    i--;
+                    break;
+                }
+                decoder->state = DecodeHunt;
+                break;
+            case DecodeData:
+                // only FLAG, ESC or a plain byte with no room left get here
+                if (byte == FLAG)
+                {
+                    decoder->state = DecodeAddress;
+                    if (decoder->size > decoder->frameFcsSize)
+                    {
+                        finishFrame(decoder, event);
+                        return i;
+                    }
+                }
+                else if (byte == ESC)
+                {
+                    decoder->escapes++;
+                    decoder->state = DecodeEscaped;
+                }
+                else
+                {
+                    // payload too long for the buffer, drop the frame
+                    decoder->state = DecodeHunt;
+                }
+                break;
+            case DecodeEscaped:
+                if (byte == FLAG || decoder->size == decoder->capacity)
+                {
+                    // a valid frame never escapes a FLAG, drop it
+                    decoder->state = byte == FLAG ? DecodeAddress : DecodeHunt;
+                }
+                else
+                {
+                    decoder->payload[decoder->size++] = byte ^ 0x20;
+                    foldPayload(decoder);
+                    decoder->state = DecodeData;
+                }
+                break;
+            case DecodeCobs:
+                // only FLAG, a code byte or a data byte with no room left get here
+                if (byte == FLAG)
+                {
+                    decoder->state = DecodeAddress;
+                    // a block cut short means bytes were lost, drop the frame
+                    if (decoder->cobsLeft == 0 && decoder->size > decoder->frameFcsSize)
+                    {
+                        finishFrame(decoder, event);
+                        return i;
+                    }
+                }
+                else if (decoder->cobsLeft == 0)
+                {
+                    // code byte: the zero ending the previous block goes in first
+                    int code = byte ^ FLAG;
+                    if (decoder->cobsZero)
+                    {
+                        if (decoder->size == decoder->capacity)
+                        {
+                            decoder->state = DecodeHunt;
+                            break;
+                        }
+                        decoder->payload[decoder->size++] = 0;
+                        foldPayload(decoder);
+                    }
+                    decoder->escapes++;
+                    decoder->cobsLeft = code - 1;
+                    decoder->cobsZero = code != 0xFF;
+                }
+                else
+                {
+                    // payload too long for the buffer, drop the frame
+                    decoder->state = DecodeHunt;
+                }
+                break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,80 @@
+// Frame sizer implementation
+
+#include "frame_sizer.h"
+#include <string.h>
+
+// weight of a new sample in the moving averages, about the last 32 frames count
+#define SIZER_GAIN (1.0 / 32)
+// error rate the estimate is capped at, past it the link is not usable anyway
+#define MAX_ERROR_RATE 0.95
+#define LN2 0.69314718055994531
+
+// Natural logarithm of x > 0, since the Makefile does not link the math library.
+double naturalLog(double x)
+{
+    // bring x into [0.5, 1), where ln x = 2 atanh((x - 1) / (x + 1)) converges fast
+    double result = 0;
+    while (x >= 1)
+    {
+        x /= 2;
+        result += LN2;
+    }
+    while (x < 0.5)
+    {
+        x *= 2;
+        result -= LN2;
+    }
+    double z = (x - 1) / (x + 1);
+    double term = z;
+    double sum = 0;
+    for (int n = 1; n < 40; n += 2)
+    {
+        sum += term / n;
+        term *= z * z;
+    }
+    return result + 2 * sum;
+}
+
+void sizerReset(FrameSizer *sizer)
+{
+    memset(sizer, 0, sizeof(*sizer));
+}
+
+void sizerSample(FrameSizer *sizer, int wireSize, bool failed)
+{
+    // the first samples are averaged evenly, so that the estimate settles fast
+    double gain = sizer->samples < 32 ? 1.0 / (sizer->samples + 1) : SIZER_GAIN;
+    sizer->errorRate += ((failed ? 1.0 : 0.0) - sizer->errorRate) * gain;
+    sizer->wireSize += (wireSize - sizer->wireSize) * gain;
+    sizer->samples++;
+}
+
+int sizerBest(const FrameSizer *sizer, double overhead, int minSize, int maxSize)
+{
+    if (sizer->errorRate <= 0 || sizer->wireSize <= 0)
+    {
+        return maxSize;
+    }
+    double errorRate = sizer->errorRate < MAX_ERROR_RATE ? sizer->errorRate : MAX_ERROR_RATE;
+    // errors per byte on the wire, from the share of frames of the average size that failed
+    double k = -naturalLog(1 - errorRate) / sizer->wireSize;
+
+    // the best size solves L (L + c) = c / k, found with Newton's method from maxSize, which only
+    // moves down towards it since the left side is convex
+    double target = overhead / k;
+    double best = maxSize;
+    if (best * (best + overhead) <= target)
+    {
+        return maxSize;
+    }
+    for (int i = 0; i < 50 && best >= minSize; i++)
+    {
+        double step = (best * (best + overhead) - target) / (2 * best + overhead);
+        best -= step;
+        if (step < 0.5)
+        {
+            break;
+        }
+    }
+    return best < minSize ? minSize : (int)best;
+}
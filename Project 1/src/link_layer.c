@@ -1,1008 +1,1830 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
-#include "serial_port.h"
+#include "link_context.h"
+#include "capabilities.h"
+#include "cobs.h"
+#include "compression.h"
+#include "fcs.h"
+#include "fec.h"
+#include "frame.h"
+#include "frame_decoder.h"
+#include "link_options.h"
+#include "link_trace.h"
+#include "retransmission_timer.h"
+#include "serial_buffer.h"
+#include "serial_context.h"
+#include "stuffing.h"
+#include "transport.h"
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
-#include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 
-#define FLAG 0x7E
-#define A_T 0x03
-#define A_R 0x01
-#define SET 0x03
-#define UA 0x07
-#define RR0 0xAA
-#define RR1 0xAB
-#define REJ0 0x54
-#define REJ1 0x55
-#define DISC 0x0B
-#define ESC 0x7D
-
 #define BUFFER_SIZE 5
 
-typedef enum
+// a held back acknowledgement goes out once no byte came for the time of this many bytes, and at least this long
+#define ACK_QUIET_BYTES 16
+#define MIN_ACK_DELAY_MS 5
+
+// the persist timer starts at the retransmission timeout, at least MIN_PERSIST_MS, and doubles up to MAX_PERSIST_MS
+#define MIN_PERSIST_MS 250
+#define MAX_PERSIST_MS 8000
+
+// with flow control, the application is taken to be slow until it called llread again within SLOW_READER_MS
+// of the last frame for SLOW_READER_FRAMES frames in a row, from llopen on and after any slower call
+#define SLOW_READER_MS 20
+#define SLOW_READER_FRAMES 16
+
+// link driven by llopen, llwrite, llread and llclose
+LinkContext defaultLink;
+
+// Called when the retransmission timer expires.
+void timeoutHandler(LinkContext *ctx)
+{
+    ctx->timerEnabled = FALSE;
+    // the persist timer of a receiver that is not ready only counts once at its longest, the receiver may be gone
+    if (ctx->peerBusy && ctx->persistDelay < MAX_PERSIST_MS)
+    {
+        return;
+    }
+    ctx->timeoutCount++;
+    traceEvent(ctx->port.fd, TraceTimeout, 0, 0, ctx->timeoutCount);
+    LOG_DEBUG("Timeout #%d\n", ctx->timeoutCount);
+}
+
+void applyOptions(LinkContext *ctx, const LinkOptions *options);
+int buildIFrame(LinkContext *ctx, TxSlot *slot, const unsigned char *buf, int bufSize, unsigned char control);
+int sendSlot(LinkContext *ctx, TxSlot *slot);
+int sendSupervision(LinkContext *ctx, unsigned char control);
+int nextFrame(LinkContext *ctx, FrameEvent *event);
+void expandPayload(LinkContext *ctx, FrameEvent *event);
+long cpuTime();
+int waitFrame(LinkContext *ctx, FrameType type, unsigned char address, bool untilTimeout, FrameEvent *frame);
+int answerRepeated(LinkContext *ctx, const FrameEvent *frame);
+int llwriteWindow(LinkContext *ctx, const unsigned char *buf, int bufSize);
+int flushWindow(LinkContext *ctx);
+int reorderFrame(LinkContext *ctx, int sequence, const unsigned char *payload, int payloadSize, bool valid);
+int deliverReordered(LinkContext *ctx, unsigned char *packet);
+int receiveDuplex(LinkContext *ctx, const FrameEvent *frame);
+int readQueued(LinkContext *ctx, unsigned char *packet);
+int acknowledgeFrame(LinkContext *ctx);
+bool receiverBackedUp(LinkContext *ctx);
+void trackReader(LinkContext *ctx);
+bool portQuiet(LinkContext *ctx, int milliseconds);
+bool byteAvailable(LinkContext *ctx);
+void startTimer(LinkContext *ctx);
+void pauseSending(LinkContext *ctx);
+void resumeSending(LinkContext *ctx);
+int probeReceiver(LinkContext *ctx);
+int waitReceiverReady(LinkContext *ctx);
+
+////////////////////////////////////////////////
+// DEFAULT LINK
+////////////////////////////////////////////////
+int llsetoptions(LinkOptions options)
+{
+    return llsetoptionsCtx(&defaultLink, options);
+}
+
+int llopen(LinkLayer connectionParameters)
+{
+    return llopenCtx(&defaultLink, connectionParameters);
+}
+
+int llwrite(const unsigned char *buf, int bufSize)
+{
+    return llwriteCtx(&defaultLink, buf, bufSize);
+}
+
+int llread(unsigned char *packet)
+{
+    return llreadCtx(&defaultLink, packet);
+}
+
+int llclose(int showStatistics)
+{
+    return llcloseCtx(&defaultLink, showStatistics);
+}
+
+void llgetoptions(LinkOptions *options)
 {
-    start,
-    flagRCV,
-    aRCV,
-    cRCV,
-    bccOK,
-    data,
-    done
-} statusReceived;
+    llgetoptionsCtx(&defaultLink, options);
+}
+
+int llpayloadsize(void)
+{
+    return llpayloadsizeCtx(&defaultLink);
+}
 
-bool alarmEnabled = FALSE;
-int alarmCount = 0;
+void llgetstats(LinkStats *stats)
+{
+    llgetstatsCtx(&defaultLink, stats);
+}
 
-unsigned char readAnswer();
-extern int fd; 
+////////////////////////////////////////////////
+// LLSETOPTIONS
+////////////////////////////////////////////////
+int llsetoptionsCtx(LinkContext *ctx, LinkOptions options)
+{
+    // full duplex runs on the window, stop-and-wait being a window of 1
+    if (options.duplex && options.arqMode == ArqStopAndWait)
+    {
+        options.arqMode = ArqGoBackN;
+        options.windowSize = 1;
+    }
+    if (options.arqMode == ArqGoBackN || options.arqMode == ArqSelectiveRepeat)
+    {
+        // selective repeat needs the window to be at most half of the sequence space to tell new frames from old ones
+        int maxWindowSize = options.arqMode == ArqGoBackN ? MAX_WINDOW_SIZE : MAX_SR_WINDOW_SIZE;
+        if (options.windowSize < 1 || options.windowSize > maxWindowSize)
+        {
+            LOG_ERROR("Window size must be between 1 and %d!\n", maxWindowSize);
+            return -1;
+        }
+    }
+    else
+    {
+        options.arqMode = ArqStopAndWait;
+        options.windowSize = 1;
+    }
+    if (options.maxPayloadSize == 0)
+    {
+        options.maxPayloadSize = MAX_PAYLOAD_SIZE;
+    }
+    if (options.ackEvery < 1)
+    {
+        options.ackEvery = 1;
+    }
+    if (options.maxPayloadSize < MIN_PAYLOAD_SIZE || options.maxPayloadSize > MAX_PAYLOAD_SIZE)
+    {
+        LOG_ERROR("Frame size must be between %d and %d!\n", MIN_PAYLOAD_SIZE, MAX_PAYLOAD_SIZE);
+        return -1;
+    }
+    ctx->requested = options;
+    return 1;
+}
 
-void alarmHandler(int signal)
+void llgetoptionsCtx(LinkContext *ctx, LinkOptions *options)
 {
-    alarmEnabled = FALSE;
-    alarmCount++;
-    printf("Alarm #%d\n", alarmCount);
+    options->arqMode = ctx->arqMode;
+    options->windowSize = ctx->windowSize;
+    options->fcsType = ctx->fcsType;
+    options->framing = ctx->framing;
+    options->fec = ctx->fec;
+    options->compression = ctx->compression;
+    options->duplex = ctx->duplex;
+    options->flowControl = ctx->flowControl;
+    options->maxPayloadSize = ctx->maxPayloadSize;
+    options->fixedFrameSize = ctx->requested.fixedFrameSize;
+    options->ackEvery = ctx->requested.ackEvery;
 }
 
-int frameNumber = 0;
-int nRetransmissions = 0;
-int timeout = 0;
-LinkLayerRole role;
+void llgetstatsCtx(LinkContext *ctx, LinkStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->role = ctx->role;
+    llgetoptionsCtx(ctx, &stats->options);
+    stats->elapsed = (ctx->closedAt != 0 ? ctx->closedAt : timerNow()) - ctx->openedAt;
+
+    long lostTime;
+    timerStats(&ctx->timer, &stats->timeouts, &lostTime, &stats->rto, &stats->srtt);
+    stats->framesSent = ctx->llwriteCount;
+    stats->transmissions = ctx->transmissionCount;
+    stats->timeoutRetransmissions = ctx->retransmissionCount - ctx->rejRetransmissionCount;
+    stats->rejRetransmissions = ctx->rejRetransmissionCount;
+    stats->probes = ctx->probeCount;
+    stats->payloadBytesSent = ctx->payloadBytesSent;
+    stats->frameBytesSent = ctx->frameBytesSent;
+    stats->wireBytesSent = ctx->port.bytesWritten;
+    stats->stuffingBytesSent = ctx->bytestuffCount;
+
+    stats->framesReceived = ctx->llreadCount;
+    stats->duplicates = ctx->duplicateCount;
+    stats->bcc1Errors = ctx->decoder.bcc1Errors;
+    stats->bcc2Errors = ctx->decoder.fcsErrors;
+    stats->payloadBytesReceived = ctx->payloadBytesReceived;
+    long readCalls;
+    receiveBufferStats(&ctx->receive, &readCalls, &stats->wireBytesReceived);
+    stats->stuffingBytesReceived = ctx->decoder.escapes;
 
-// variable for the ammount of bytes read
-int readBytes = 0;
-int frameCount = 0;
-int totalFrameSize = 0;
+    stats->rtt = ctx->rttHistogram;
+    stats->latency = ctx->latencyHistogram;
+}
 
-int llopenCount, llwriteCount, llreadCount, llcloseCount, bytestuffCount, byteCount = 0;
+int llpayloadsizeCtx(LinkContext *ctx)
+{
+    if (ctx->requested.fixedFrameSize)
+    {
+        return ctx->maxPayloadSize;
+    }
+    // cost of a frame besides its payload, in bytes: header, check sequence and closing FLAG,
+    // and with stop-and-wait the wait for the answer, which no other frame fills
+    double overhead = 4 + fcsSize(ctx->fcsType) + 1;
+    if (ctx->arqMode == ArqStopAndWait)
+    {
+        int expiries, rto, srtt;
+        long lostTime;
+        timerStats(&ctx->timer, &expiries, &lostTime, &rto, &srtt);
+        overhead += srtt > 0 && ctx->timer.byteTime > 0 ? srtt * 1000000.0 / ctx->timer.byteTime : BUFFER_SIZE;
+    }
+    return sizerBest(&ctx->sizer, overhead, MIN_PAYLOAD_SIZE, ctx->maxPayloadSize);
+}
 
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters)
+int llopenCtx(LinkContext *ctx, LinkLayer connectionParameters)
 {
-    printf("Starting llopen.\n");
+    LOG_INFO("Starting llopen.\n");
 
-    fd = openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate);
+    int fd = serialOpen(&ctx->port, connectionParameters.serialPort, connectionParameters.baudRate);
     if (fd < 0)
     {
-        printf("Error on open serial port function on llopen!\n");
+        LOG_ERROR("Error on open serial port function on llopen!\n");
+        return -1;
+    }
+    resetReceiveBuffer(&ctx->receive, &ctx->port);
+
+    // the configured timeout is only the starting point, it then follows the measured round-trip time; the
+    // time of the bytes on the line only counts on a tty, a faster stream would leave it far ahead of the clock
+    int lineRate = ctx->port.transport->paced ? connectionParameters.baudRate : 0;
+    if (timerOpen(&ctx->timer, connectionParameters.timeout * 1000, lineRate) < 0)
+    {
+        LOG_ERROR("Error creating the retransmission timer on llopen!\n");
         return -1;
     }
+    ctx->timeoutCount = 0;
+    ctx->timerEnabled = FALSE;
 
-    alarm(0);
-    alarmCount = 0;
-    alarmEnabled = FALSE;
+    int status = 0;
+    ctx->nRetransmissions = connectionParameters.nRetransmissions;
+    ctx->timeout = connectionParameters.timeout;
+    ctx->role = connectionParameters.role;
+    ctx->frameNumber = 0;
+    ctx->windowBase = 0;
+    ctx->windowCount = 0;
+    memset(ctx->rejSent, 0, sizeof(ctx->rejSent));
+    memset(ctx->reorderFull, 0, sizeof(ctx->reorderFull));
+    ctx->rxQueueHead = 0;
+    ctx->rxQueueCount = 0;
+    ctx->ackPending = FALSE;
+    ctx->unacked = 0;
+    ctx->notReady = FALSE;
+    ctx->peerBusy = FALSE;
+    ctx->deliveredAt = 0;
+    ctx->slowReads = SLOW_READER_FRAMES;
+    ctx->address = ctx->role == LlTx ? A_T : A_R;
+    ctx->peerAddress = ctx->role == LlTx ? A_R : A_T;
 
-    char byte;
-    statusReceived status = start;
-    nRetransmissions = connectionParameters.nRetransmissions;
-    timeout = connectionParameters.timeout;
-    role = connectionParameters.role;
+    // a zeroed context has not been through llsetoptionsCtx, which stands for the defaults
+    if (ctx->requested.maxPayloadSize == 0)
+    {
+        llsetoptionsCtx(ctx, ctx->requested);
+    }
+    LinkOptions own = ctx->requested;
+    // until the SET/UA exchange agrees on something else, and with a peer that does not take part in it,
+    // the link runs with its own options, byte stuffing, no forward error correction nor compression, one way
+    // only and without RNR, which such a peer would not understand
+    LinkOptions local = own;
+    local.framing = FramingStuffing;
+    local.fec = FecNone;
+    local.compression = CompressionNone;
+    local.duplex = FALSE;
+    local.flowControl = FALSE;
+    applyOptions(ctx, &local);
 
-    if(role == LlTx)
+    if(ctx->role == LlTx)
     {
-        (void) signal(SIGALRM, alarmHandler);
-        char buf[BUFFER_SIZE] = {FLAG, A_T, SET, A_T ^ SET, FLAG};
+        unsigned char set[MAX_CAPABILITY_FRAME_SIZE];
+        int setSize = capabilityFrame(SET, &own, set);
+        unsigned char plainSet[BUFFER_SIZE] = {FLAG, A_T, SET, A_T ^ SET, FLAG};
+        FrameEvent answer;
+        LinkOptions agreed;
 
-        while(nRetransmissions > alarmCount && status != done)
+        // send SET until an UA comes back
+        while(ctx->nRetransmissions > ctx->timeoutCount && status != 1)
         {
-            if (!alarmEnabled)
+            // a peer that only knows the plain SET drops the one with capabilities, so the second half of the tries
+            // goes without them; before that a lost UA is retried with capabilities, or the ends could keep
+            // options that do not match
+            bool plain = ctx->timeoutCount >= (ctx->nRetransmissions + 1) / 2;
+            if(serialWrite(&ctx->port, plain ? plainSet : set, plain ? BUFFER_SIZE : setSize) < 0)
             {
-                if(writeBytes((char *)buf, BUFFER_SIZE) < 0)
-                {
-                    printf("Write error (SET) by transmitter on llopen!\n");
-                    return -1;
-                }
-                alarm(connectionParameters.timeout);
-                alarmEnabled = TRUE;
-                status = start;
+                LOG_ERROR("Write error (SET) by transmitter on llopen!\n");
+                return -1;
             }
-            while(status != done && alarmEnabled == TRUE)
+            timerStart(&ctx->timer);
+            ctx->timerEnabled = TRUE;
+
+            // an UA with capabilities we cannot use is ignored like a damaged one
+            do
             {
-                readBytes = readByte(&byte);
-                if (readBytes < 0)
-                {
-                    printf("Read byte error on llopen, transmitter side!\n");
-                    return -1;
-                }
-                if (readBytes != 0)
-                {
-                    switch (status)
-                    {
-                        case start:
-                            if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            break;
-                        case flagRCV:
-                            if (byte == A_T)
-                            {
-                                status = aRCV;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case aRCV:
-                            if (byte == UA)
-                            {
-                                status = cRCV;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case cRCV:
-                            if(byte == (A_T ^ UA))
-                            {
-                                status = bccOK;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case bccOK:
-                            if (byte == FLAG)
-                            {
-                                status = done;
-                                alarmEnabled = FALSE;
-                                alarmCount = 0;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        default:
-                            status = start;
-                            break;
-                    }
-                }
+                status = waitFrame(ctx, FrameUa, A_T, TRUE, &answer);
+            } while (status == 1 && answer.payloadSize > 0 &&
+                     capabilitiesRead(ctx->frameBuffer, answer.payloadSize, &agreed) < 0);
+            if (status < 0)
+            {
+                LOG_ERROR("Read byte error on llopen, transmitter side!\n");
+                return -1;
             }
         }
-        if (alarmCount >= connectionParameters.nRetransmissions) 
+        timerStop(&ctx->timer);
+        ctx->timerEnabled = FALSE;
+        if (status != 1)
         {
-            printf("Max retransmissions reached!\n");
+            LOG_ERROR("Max retransmissions reached!\n");
             return -1;
         }
+        ctx->timeoutCount = 0;
+        // a plain UA means the receiver keeps its own options
+        if (answer.payloadSize > 0)
+        {
+            applyOptions(ctx, &agreed);
+        }
     }
-    else if(role == LlRx)
+    else if(ctx->role == LlRx)
     {
-        while (status != done)
+        FrameEvent set;
+        LinkOptions offer;
+        do
         {
-            readBytes = readByte(&byte);
-            if (readBytes < 0)
+            if (waitFrame(ctx, FrameSet, A_T, FALSE, &set) < 0)
             {
-                printf("Read byte error on receiver side on llopen!\n");
+                LOG_ERROR("Read byte error on receiver side on llopen!\n");
                 return -1;
             }
-            if (readBytes != 0)
-            {
-                switch (status)
-                {
-                    case start:
-                        if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        break;
-                    case flagRCV:
-                        if (byte == A_T)
-                        {
-                            status = aRCV;
-                        }
-                        else if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        else
-                        {
-                            status = start;
-                        }
-                        break;
-                    case aRCV:
-                        if (byte == SET)
-                        {
-                            status = cRCV;
-                        }
-                        else if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        else
-                        {
-                            status = start;
-                        }
-                        break;
-                    case cRCV:
-                        if (byte == (SET ^ A_T))
-                        {
-                            status = bccOK;
-                        }
-                        else if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        else 
-                        {
-                            status = start;
-                        }
-                        break;
-                    case bccOK:
-                        if (byte == FLAG)
-                        {
-                            status = done;
-                        }
-                        else 
-                        {
-                            status = start;
-                        }
-                        break;
-                    default:
-                        status = start;
-                        break;
-                }
-            }
+        } while (set.payloadSize > 0 && capabilitiesRead(ctx->frameBuffer, set.payloadSize, &offer) < 0);
+
+        // answer capabilities with the options both ends will use, and a plain SET with a plain UA
+        if (set.payloadSize > 0)
+        {
+            LinkOptions agreed;
+            capabilitiesAgree(&offer, &own, &agreed);
+            ctx->uaSize = capabilityFrame(UA, &agreed, ctx->uaFrame);
+            applyOptions(ctx, &agreed);
         }
-        char buf[BUFFER_SIZE] = {FLAG, A_T, UA, A_T ^ UA, FLAG};
-        if (writeBytes((char *)buf, BUFFER_SIZE) < 0)
+        else
+        {
+            unsigned char ua[BUFFER_SIZE] = {FLAG, A_T, UA, A_T ^ UA, FLAG};
+            memcpy(ctx->uaFrame, ua, BUFFER_SIZE);
+            ctx->uaSize = BUFFER_SIZE;
+        }
+        if (serialWrite(&ctx->port, ctx->uaFrame, ctx->uaSize) < 0)
         {
-            printf("Write bytes error on llopen answer!\n");
+            LOG_ERROR("Write bytes error on llopen answer!\n");
             return -1;
         }
     }
     else
     {
-        printf("Invalid connection parameter role!\n");
+        LOG_ERROR("Invalid connection parameter role!\n");
         return -1;
     }
-    printf("LLOPEN done!\n");
-    llopenCount++;
+    LOG_INFO("Link uses %d byte frames, ARQ mode %d with window %d, check sequence %d, framing %d, error correction %d, compression %d, full duplex %d.\n",
+           ctx->maxPayloadSize, ctx->arqMode, ctx->windowSize, ctx->fcsType, ctx->framing, ctx->fec, ctx->compression, ctx->duplex);
+    LOG_INFO("LLOPEN done!\n");
+    traceEvent(fd, TraceOpen, 0, ctx->maxPayloadSize, ctx->arqMode);
+    ctx->openedAt = timerNow();
+    ctx->closedAt = 0;
+    ctx->llopenCount++;
     return fd;
 }
 
+// Use options on the link from the next frame on.
+void applyOptions(LinkContext *ctx, const LinkOptions *options)
+{
+    ctx->arqMode = options->arqMode;
+    ctx->windowSize = options->windowSize;
+    ctx->seqModulus = ctx->arqMode == ArqStopAndWait ? 2 : SEQ_BITS_MODULUS;
+    ctx->fcsType = options->fcsType;
+    ctx->framing = options->framing;
+    ctx->fec = options->fec;
+    ctx->compression = options->compression;
+    ctx->maxPayloadSize = options->maxPayloadSize;
+    ctx->duplex = options->duplex;
+    ctx->flowControl = options->flowControl;
+    sizerReset(&ctx->sizer);
+    decoderInit(&ctx->decoder, ctx->frameBuffer, sizeof(ctx->frameBuffer), ctx->fcsType, ctx->seqModulus);
+    decoderSetFraming(&ctx->decoder, ctx->framing);
+    decoderSetFec(&ctx->decoder, ctx->fec);
+    decoderSetCompression(&ctx->decoder, ctx->compression);
+    // in full duplex an acknowledgement may go out after the whole window the other end has in flight
+    int dataField = ctx->maxPayloadSize + fcsSize(ctx->fcsType);
+    dataField = ctx->fec != FecNone ? FEC_ENCODED_SIZE(dataField) : dataField;
+    timerSetAnswerDelay(&ctx->timer, ctx->duplex ? ctx->windowSize * (4 + dataField + 1) : 0);
+    // while the receiver is not ready, the frames in flight must fit in what the serial driver keeps for it
+    int credit = TTY_BUFFER_SIZE / (4 + dataField + 1);
+    ctx->receiveCredit = credit < 1 ? 1 : credit > ctx->windowSize ? ctx->windowSize : credit;
+    if (ctx->duplex)
+    {
+        decoderSetDuplex(&ctx->decoder);
+    }
+
+    // a delayed RR must leave the transmitter room in its window to keep sending, so stop-and-wait and
+    // full duplex, which has the next I frame to carry it, acknowledge every frame
+    int ackEvery = ctx->requested.ackEvery < ctx->windowSize / 2 ? ctx->requested.ackEvery : ctx->windowSize / 2;
+    ctx->ackEvery = ctx->duplex || ackEvery < 1 ? 1 : ackEvery;
+    // the port is quiet once no byte came for the time of ACK_QUIET_BYTES, more frames are then not on their way
+    ctx->ackDelay = ctx->duplex ? 0 : (ACK_QUIET_BYTES * ctx->timer.byteTime + 999999) / 1000000;
+    ctx->ackDelay = ctx->duplex || ctx->ackDelay >= MIN_ACK_DELAY_MS ? ctx->ackDelay : MIN_ACK_DELAY_MS;
+}
+
 ////////////////////////////////////////////////
-// LLWRITE
+// FRAME RECEPTION
 ////////////////////////////////////////////////
 
-int llwrite(const unsigned char *buf, int bufSize)
+// Decode the next frame from the receive buffer, reading the serial port when it is empty.
+// Returns 1 with the frame in event, 0 if no frame was completed yet, -1 on error.
+int nextFrame(LinkContext *ctx, FrameEvent *event)
 {
-    // frame size is buffer size, plus the 4 initial bytes, FLAG, A, FRAME NUMBER, BCC1, and 2 final ones, BCC2 and FLAG
-    int frameSize = 4 + bufSize + 2; 
-    // counter for all bytes that need stuffing
-    int bytesStuffed = 0;
-
-    // get the ammount of bytes that need stuffing here (and in total), and increment the byte count for all written bytes
-    for (int i = 0; i < bufSize; i++)
+    const unsigned char *span;
+    int available = receivedSpan(&ctx->receive, &span);
+    if (available == 0)
     {
-        if(buf[i] == FLAG || buf[i] == ESC)
+        // no I frame went out to carry the acknowledgement and no more frames are coming, so send it on its own
+        // before going idle
+        if (ctx->ackPending && portQuiet(ctx, ctx->ackDelay) && sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
+        {
+            event->type = FrameNone;
+            return -1;
+        }
+        // wait for bytes or for the retransmission timer
+        int ready = timerWait(&ctx->timer, ctx->port.fd);
+        if (ready <= 0)
+        {
+            if (ready == 0)
+            {
+                timeoutHandler(ctx);
+            }
+            event->type = FrameNone;
+            return ready;
+        }
+        int bytes = fillReceiveBuffer(&ctx->receive);
+        if (bytes <= 0)
         {
-            bytestuffCount++;
-            bytesStuffed++;
+            event->type = FrameNone;
+            return bytes;
         }
-        byteCount++;
+        available = receivedSpan(&ctx->receive, &span);
     }
-
-    // get the bcc2 based on the buffer data
-    unsigned char bcc2 = buf[0];
-    for (int i = 1; i < bufSize; i++) {
-        bcc2 ^= buf[i];
+    // between frames the decoder waits in DecodeHunt or DecodeAddress
+    bool idle = ctx->decoder.state <= DecodeAddress;
+    int bcc1Errors = ctx->decoder.bcc1Errors;
+    consumeReceived(&ctx->receive, decodeBytes(&ctx->decoder, span, available, event));
+    if (idle && (ctx->decoder.state > DecodeAddress || event->type != FrameNone))
+    {
+        traceEvent(ctx->port.fd, TraceFrameStart, 0, available, 0);
+    }
+    if (ctx->decoder.bcc1Errors > bcc1Errors)
+    {
+        traceEvent(ctx->port.fd, TraceBcc1Error, 0, 0, ctx->decoder.bcc1Errors - bcc1Errors);
+    }
+    if (event->type == FrameI && event->valid && event->compressed)
+    {
+        expandPayload(ctx, event);
+    }
+    if (event->type != FrameNone)
+    {
+        traceEvent(ctx->port.fd, event->type == FrameI && !event->valid ? TraceBadFrame : TraceFrame,
+                   event->sequence, event->payloadSize, event->type);
     }
+    return event->type != FrameNone;
+}
 
-    // careful with stuffing for bcc2
-    if (bcc2 == FLAG || bcc2 == ESC)
+// Decompress the payload of an I frame in frameBuffer, in place. A payload that does not decompress
+// to at most maxPayloadSize bytes is taken as one whose check sequence failed.
+void expandPayload(LinkContext *ctx, FrameEvent *event)
+{
+    unsigned char plain[MAX_PAYLOAD_SIZE];
+    long start = cpuTime();
+    int size = lzDecompress(ctx->frameBuffer, event->payloadSize, plain, ctx->maxPayloadSize);
+    ctx->decompressTime += cpuTime() - start;
+    if (size < 0)
     {
-        bytesStuffed++;
+        ctx->decoder.fcsErrors++;
+        event->valid = FALSE;
+        return;
     }
+    ctx->packedBytesReceived += event->payloadSize;
+    ctx->plainBytesReceived += size;
+    memcpy(ctx->frameBuffer, plain, size);
+    event->payloadSize = size;
+}
 
-    // re-define the size of the frame, to sum the stuffing 
-    frameSize += bytesStuffed;
+// CPU time used by the calling thread, in microseconds.
+long cpuTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
 
-    // create the frame and initialize the starting bytes
-    unsigned char frame[frameSize];
-    // flag to indicate start of frame
-    frame[0] = FLAG;
-    // address
-    frame[1] = A_T;
-    // frame number
-    frame[2] = frameNumber << 7;
-    // bcc1
-    frame[3] = frame[1] ^ frame[2];
+// Wait for a frame of the given type and address, skipping any other frame.
+// If untilTimeout is TRUE, only waits while the retransmission timer is running.
+// The frame is copied to frame, unless it is NULL.
+// Returns 1 when the frame arrives, 0 if the timer expired first, -1 on error.
+int waitFrame(LinkContext *ctx, FrameType type, unsigned char address, bool untilTimeout, FrameEvent *frame)
+{
+    while (!untilTimeout || ctx->timerEnabled)
+    {
+        FrameEvent event;
+        int result = nextFrame(ctx, &event);
+        if (result < 0)
+        {
+            return -1;
+        }
+        if (result > 0 && event.type == type && event.address == address && event.valid)
+        {
+            if (frame != NULL)
+            {
+                *frame = event;
+            }
+            return 1;
+        }
+        // the receiver keeps answering frames the transmitter repeats, e.g. the last I frame while waiting for DISC,
+        // and so do both ends of a full-duplex link
+        if (result > 0 && (ctx->role == LlRx || ctx->duplex) && answerRepeated(ctx, &event) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    // go byte by byte on the frame (i) and on the buffer (j), and do appropriate stuffing in case of need
-    for(int i = 4, j = 0; i < frameSize && j < bufSize; i++, j++)
+// Answer again a frame the transmitter repeated because our answer to it got lost:
+// an I frame already delivered gets RR(frameNumber) right away and a SET gets its UA,
+// instead of leaving the transmitter to time out. A plain SET after one with capabilities gets the UA with the
+// agreed options too, the transmitter only fell back to it because that UA got lost.
+// Returns 1 if the frame was answered, 0 if it is not a repeated frame, -1 on error.
+int answerRepeated(LinkContext *ctx, const FrameEvent *frame)
+{
+    if (frame->address != ctx->peerAddress)
+    {
+        return 0;
+    }
+    if (frame->type == FrameSet && frame->valid)
     {
-        if(buf[j] == FLAG || buf[j] == ESC)
+        if (serialWrite(&ctx->port, ctx->uaFrame, ctx->uaSize) < 0)
         {
-            // increment i by one more, to keep track of stuffing
-            frame[i++] = ESC;
-            frame[i] = buf[j] ^ 0x20;
+            LOG_ERROR("Write bytes error answering a repeated SET!\n");
+            return -1;
         }
-        else
+        return 1;
+    }
+    if (frame->type == FrameI && frame->sequence != ctx->frameNumber)
+    {
+        ctx->duplicateCount++;
+        if (sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
         {
-            frame[i] = buf[j];
+            LOG_ERROR("Write bytes error answering a repeated I frame!\n");
+            return -1;
         }
+        return 1;
     }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// LLWRITE
+////////////////////////////////////////////////
 
-    // put correct values of bcc2
-    if (bcc2 == FLAG || bcc2 == ESC)
+int llwriteCtx(LinkContext *ctx, const unsigned char *buf, int bufSize)
+{
+    if (bufSize > ctx->maxPayloadSize)
     {
-        frame[frameSize - 3] = ESC;
-        frame[frameSize - 2] = bcc2 ^ 0x20;
+        LOG_ERROR("Packet of %d bytes is larger than the %d agreed on llopen!\n", bufSize, ctx->maxPayloadSize);
+        return -1;
     }
-    else 
+    if (ctx->arqMode != ArqStopAndWait)
     {
-        frame[frameSize - 2] = bcc2;
+        return llwriteWindow(ctx, buf, bufSize);
     }
 
-    // terminate the frame
-    frame[frameSize - 1] = FLAG;
+    // build the frame in the slot of its sequence number, where it stays for any retransmission
+    TxSlot *slot = &ctx->txSlots[ctx->frameNumber];
+    int frameSize = buildIFrame(ctx, slot, buf, bufSize, C_I(ctx->frameNumber));
 
-    // reset the alarm
-    alarm(0);
-    alarmCount = 0;
-    alarmEnabled = FALSE;
+    // reset the timer
+    timerStop(&ctx->timer);
+    ctx->timeoutCount = 0;
+    ctx->timerEnabled = FALSE;
+    // when the last copy left the port, only frames written once give a round-trip sample (Karn's rule)
+    long sentAt = 0;
+    bool resent = FALSE;
+    bool rejected = FALSE;
 
     // try to send the prepared I frame, with the connection parameters in mind
-    while (alarmCount < nRetransmissions && alarmCount != -1)
+    while (ctx->timeoutCount < ctx->nRetransmissions && ctx->timeoutCount != -1)
     {
-        // enable the alarm and re-write in case of timeout
-        if (!alarmEnabled)
+        // start the timer and re-write in case of timeout
+        if (!ctx->timerEnabled)
         {
-            if (writeBytes((char *)frame, frameSize) < 0)
+            if (sendSlot(ctx, slot) < 0)
             {
-                printf("Write byte error on llwrite!\n");
+                LOG_ERROR("Write byte error on llwrite!\n");
                 return -1;
             }
-            alarmEnabled = TRUE;
-            alarm(timeout);
+            resent = sentAt != 0;
+            traceEvent(ctx->port.fd, !resent ? TraceSend : ctx->peerBusy ? TraceProbe : TraceResend, ctx->frameNumber, frameSize, 0);
+            // the copy sent before was lost or rejected, unless this one probes a receiver that is not ready
+            if (resent && ctx->peerBusy)
+            {
+                ctx->probeCount++;
+                ctx->persistDelay = ctx->persistDelay * 2 < MAX_PERSIST_MS ? ctx->persistDelay * 2 : MAX_PERSIST_MS;
+            }
+            else if (resent)
+            {
+                sizerSample(&ctx->sizer, frameSize, TRUE);
+                ctx->retransmissionCount++;
+                ctx->rejRetransmissionCount += rejected;
+            }
+            rejected = FALSE;
+            sentAt = timerSent(&ctx->timer, frameSize);
+            startTimer(ctx);
         }
-        // if alarm is enabled, wait for the answer from the receiver and proccess it accordingly
-        while (alarmEnabled == TRUE) 
+        // while the timer runs, wait for the answer from the receiver and proccess it accordingly
+        while (ctx->timerEnabled == TRUE)
         {
             // get the answer from receiver after writing frame.
-            unsigned char answer = readAnswer(fd);
+            FrameEvent answer;
+            int result = nextFrame(ctx, &answer);
 
-            // answer got a timeout, just continue and try again
-            if (answer == 0)
+            // no complete answer yet, just continue and try again
+            if (result == 0)
             {
                 continue;
             }
-            
-            // when we get a 1, we got error on function to get answer, so respond accordingly
-            else if (answer == 1)
+
+            // we got error on function to get answer, so respond accordingly
+            else if (result < 0)
             {
-                printf("Answer error!\n");
+                LOG_ERROR("Answer error!\n");
                 return -1;
             }
 
+            // only answers from the receiver matter here
+            else if (answer.address != A_T || (answer.type != FrameRr && answer.type != FrameRej && answer.type != FrameRnr))
+            {
+                continue;
+            }
+
             // if the frame is rejected, re-write
-            else if ((answer == REJ0 && frameNumber == 0) || (answer == REJ1 && frameNumber == 1))
+            else if (answer.type == FrameRej && answer.sequence == ctx->frameNumber)
             {
-                printf("Rejected frame, retrying to write.\n");
-                // reset the alarm to re-write
-                alarm(0);
-                alarmCount = 0;
-                alarmEnabled = FALSE;
+                LOG_DEBUG("Rejected frame, retrying to write.\n");
+                rejected = TRUE;
+                resumeSending(ctx);
+                // stop the timer to re-write
+                timerStop(&ctx->timer);
+                ctx->timeoutCount = 0;
+                ctx->timerEnabled = FALSE;
                 break;
             }
-            // frame was accepted, receiver requesting next frame, flip frame number and set alarm count to -1 to exit loop
-            else if ((answer == RR0 && frameNumber == 1) || (answer == RR1 && frameNumber == 0))
+            // the receiver is not ready for the frame yet, keep it in flight on the persist timer
+            else if (answer.type == FrameRnr && answer.sequence == ctx->frameNumber)
+            {
+                pauseSending(ctx);
+                startTimer(ctx);
+            }
+            // the receiver reads again and the frame is on its way, time it from now on
+            else if (answer.type == FrameRr && answer.sequence == ctx->frameNumber && ctx->peerBusy)
             {
-                printf("Answer is %u.\n", answer);
-                frameNumber = 1 - frameNumber;
-                alarmCount = -1;
+                resumeSending(ctx);
+                startTimer(ctx);
+            }
+            // frame was accepted, receiver requesting next frame, flip frame number and set timeout count to -1 to exit loop;
+            // with RNR the next frame goes out on the persist timer
+            else if ((answer.type == FrameRr || answer.type == FrameRnr) && answer.sequence != ctx->frameNumber)
+            {
+                LOG_DEBUG("Answer is %s%d.\n", answer.type == FrameRr ? "RR" : "RNR", answer.sequence);
+                if (answer.type == FrameRnr)
+                {
+                    pauseSending(ctx);
+                }
+                else
+                {
+                    resumeSending(ctx);
+                }
+                timerStop(&ctx->timer);
+                if (!resent)
+                {
+                    timerSample(&ctx->timer, timerNow() - sentAt);
+                    histogramAdd(&ctx->rttHistogram, timerNow() - sentAt);
+                }
+                long latency = timerNow() - slot->builtAt;
+                histogramAdd(&ctx->latencyHistogram, latency);
+                traceEvent(ctx->port.fd, TraceAck, ctx->frameNumber, frameSize, latency < UINT16_MAX ? latency : UINT16_MAX);
+                sizerSample(&ctx->sizer, frameSize, FALSE);
+                ctx->frameNumber = 1 - ctx->frameNumber;
+                ctx->timeoutCount = -1;
                 break;
             }
             // dessincronized or unexpected behaviour
             else
             {
-                printf("Answer is %u.\n", answer);
-                printf("Something went reaaally wrong!\n");
+                LOG_DEBUG("Answer is %s%d.\n", answer.type == FrameRr ? "RR" : "REJ", answer.sequence);
+                LOG_DEBUG("Something went reaaally wrong!\n");
                 break;
             }
         }
     }
 
     // if the exit condition was max transmissions reached, print warning, close the port and return error
-    if (alarmCount == nRetransmissions)
+    if (ctx->timeoutCount == ctx->nRetransmissions)
     {
-        printf("Max retransmissions reached, aborting!\n");
-        llclose(fd);
+        LOG_ERROR("Max retransmissions reached, aborting!\n");
+        llcloseCtx(ctx, TRUE);
         return -1;
     }
 
     // update statistics
-    llwriteCount++;
-    printf("LLWRITE done!\n");
+    ctx->llwriteCount++;
+    LOG_DEBUG("LLWRITE done!\n");
     return frameSize;
 }
 
-unsigned char readAnswer()
+// Build an I frame around buf in slot.
+// Returns the size of the frame.
+int buildIFrame(LinkContext *ctx, TxSlot *slot, const unsigned char *buf, int bufSize, unsigned char control)
 {
-    // start state machine and set values to 0
-    statusReceived status = start;
-    unsigned char byte, answer = 0x00;
-    // simple state machine that extracts answer out from a frame
-    while (status != done)
+    ctx->payloadBytesSent += bufSize;
+    slot->builtAt = timerNow();
+
+    // the payload goes compressed if that makes it shorter, the address telling the receiver so
+    unsigned char packed[MAX_PAYLOAD_SIZE];
+    bool compressed = FALSE;
+    if (ctx->compression != CompressionNone && bufSize > 0)
     {
-        readBytes = readByte((char *)&byte);
-        if (readBytes > 0)
-        {
-            switch (status)
-            {
-                case start:
-                    if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    break;
-                case flagRCV:
-                    if (byte == A_T)
-                    {
-                        status = aRCV;
-                    }
-                    else if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    else
-                    {
-                        status = start;
-                    }
-                    break;
-                case aRCV:
-                    if (byte == REJ0 || byte == REJ1 || byte == RR0 || byte == RR1)
-                    {
-                        status = cRCV;
-                        answer = byte;
-                    }
-                    else if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    else
-                    {
-                        status = start;
-                    }
-                    break;
-                case cRCV:
-                    if (byte == (A_T ^ answer))
-                    {
-                        status = bccOK;
-                    }
-                    else if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    else 
-                    {
-                        status = start;
-                    }
-                    break;
-                case bccOK:
-                    if (byte == FLAG)
-                    {
-                        status = done;
-                    }
-                    else 
-                    {
-                        status = start;
-                    }
-                    break;
-                default:
-                    break;
-            }
-        }
-        else if (readBytes == 0)
+        long start = cpuTime();
+        int packedSize = lzCompress(buf, bufSize, packed, bufSize - 1);
+        ctx->compressTime += cpuTime() - start;
+        ctx->plainBytesSent += bufSize;
+        compressed = packedSize > 0;
+        if (compressed)
         {
-            return 0;
+            buf = packed;
+            bufSize = packedSize;
         }
         else
         {
-            printf("Read byte error in read answer!\n");
-            return 1;
+            ctx->rawFrameCount++;
         }
+        ctx->packedBytesSent += bufSize;
     }
-    return answer;
-}
 
-////////////////////////////////////////////////
-// LLREAD
-////////////////////////////////////////////////
-int llread(unsigned char *packet)
-{
-    unsigned char byte, controlField;
-    statusReceived status = start;
-    int packetSize = 0;
-    bool destuff = FALSE;
-    
-    while(status != done)
+    unsigned char *frame = slot->frame;
+    // flag to indicate start of frame
+    frame[0] = FLAG;
+    // address
+    frame[1] = compressed ? ctx->address | A_COMPRESSED : ctx->address;
+    // frame number
+    frame[2] = control;
+    // bcc1
+    frame[3] = frame[1] ^ frame[2];
+
+    unsigned char fcs[MAX_FCS_SIZE];
+
+    // forward error correction covers the payload and its frame check sequence, then the encoded blocks
+    // are framed like a payload without a check sequence of its own
+    if (ctx->fec != FecNone)
     {
-        // read the byte from the serial port
-        readBytes = readByte(&byte);
-        // return error in case of error
-        if (readBytes < 0)
+        unsigned char plain[MAX_PAYLOAD_SIZE + MAX_FCS_SIZE];
+        unsigned char encoded[MAX_DATA_FIELD_SIZE];
+        memcpy(plain, buf, bufSize);
+        int size = fcsWrite(ctx->fcsType, fcsCompute(ctx->fcsType, buf, bufSize), plain + bufSize);
+        int encodedSize = fecEncode(plain, bufSize + size, encoded);
+        int idx = 4;
+        if (ctx->framing == FramingCobs)
         {
-            printf("Read byte error on llread!\n");
-            return -1;
+            CobsEncoder encoder;
+            cobsStart(&encoder, frame + 4);
+            cobsUpdate(&encoder, encoded, encodedSize);
+            int cobsSize = cobsFinish(&encoder);
+            ctx->bytestuffCount += cobsSize - encodedSize;
+            idx += cobsSize;
         }
-        // only if we read a byte do we continue the switch case, otherwise just keep waiting
-        if (readBytes > 0)
+        else
         {
-            switch(status)
-            {
-                case start:
-                    // start flag
-                    if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    break;
-                case flagRCV:
-                    // check for the adress field
-                    if (byte == A_T)
-                    {
-                        status = aRCV;
-                    }
-                    else if (byte != FLAG)
-                    {
-                        status = start;
-                    }
-                    break;
-                case aRCV:
-                    // check for the control field, only accept matching frame numbers
-                    if ((frameNumber == 0 && byte == 0x00) || (frameNumber == 1 && byte == 0x80)) // Frame = 0 or frame = 1
-                    {
-                        status = cRCV;
-                        controlField = byte;
-                    }
-                    else if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    else
-                    {
-                        status = start;
-                    }
-                    break;
-                case cRCV:
-                    // check bcc1
-                    if (byte == (A_T ^ controlField))
-                    {
-                        status = data;
-                    }
-                    else if (byte == FLAG)
-                    {
-                        status = flagRCV;
-                    }
-                    else 
-                    {
-                        printf("BCC1 error!\n");
-                        status = start;
-                    }
-                    break;
-                case data:
-                    // case to avoid overflow, reached max payload
-                    if (packetSize > MAX_PAYLOAD_SIZE) 
-                    {
-                        printf("Buffer overflow on llread packet!\n");
-                        return -1;
-                    }
-                    // if destuff flag is true, correctly destuff the byte and add to packet
-                    if (destuff)
-                    {
-                        // valid frames should never have FLAG to be destuffed
-                        if (byte == FLAG)
-                        {
-                            printf("Invalid frame: ESC character followed by FLAG!\n");
-                            return -1;
-                        }
-                        byte ^= 0x20;
-                        destuff = FALSE;
-                        packet[packetSize++] = byte;
-                        byteCount++;
-                    }
-                    // if byte encountered is ESC, we need to destuff the next byte and skip this one 
-                    else if (byte == ESC)
-                    {
-                        destuff = TRUE;
-                        bytestuffCount++;
-                    }
-                    // if we find a flag, check bcc2 to terminate
-                    else if(byte == FLAG)
-                    {
-                        // check if it is valid packet with anyhting
-                        if (packetSize <= 0)
-                        {
-                            printf("No data received before FLAG. Invalid frame.\n");
-                            return -1;
-                        }
-
-                        // check bcc2 from transmitter
-                        unsigned char bcc2 = packet[packetSize - 1];
-                        packetSize--;
-                        byteCount--;
-                        // calculate bcc2 from received data
-                        unsigned char receivedBcc2 = packet[0];
-                        for(unsigned int i = 1; i < packetSize; i++){
-                            receivedBcc2 = receivedBcc2 ^ packet[i];
-                        }
-
-                        // if they are equal, we are good! and can flip frame number to request the next frame with a reply
-                        if(bcc2 == receivedBcc2){
-                            status = done;
-                            frameNumber = 1 - frameNumber;
-                            unsigned char rrControlField = frameNumber ? RR1 : RR0;
-                            unsigned char bcc = A_T ^ rrControlField;
-                            unsigned char rrFrame[BUFFER_SIZE] = {FLAG, A_T, rrControlField, bcc, FLAG};
-                            if (writeBytes((char *)rrFrame, sizeof(rrFrame)) < 0)
-                            {
-                                printf("Write bytes error on reply from rx, llread!\n");
-                                return -1;
-                            }
-                            llreadCount++;
-                            printf("Reading done!\n");
-                            return packetSize;
-                        }
-                        else
-                        {
-                            // If BCC2 is incorrect then send REJ, don't flip frame number cuz we reject the old one
-                            printf("BCC2 error!\n");
-                            unsigned char rejControlField = frameNumber ? REJ1 : REJ0;
-                            unsigned char bcc = A_T ^ rejControlField;
-                            unsigned char rejFrame[BUFFER_SIZE] = {FLAG, A_T, rejControlField, bcc, FLAG};
-                            if (writeBytes((char *)rejFrame, sizeof(rejFrame)) < 0)
-                            {
-                                printf("Write bytes error on rejection from rx, llread!\n");
-                                return -1;
-                            }
-                            return 0;
-                        }
-                    }
-                    // base case, add a normal byte to the packet
-                    else
-                    {
-                        packet[packetSize++] = byte;
-                        byteCount++;
-                    }
-                    break;
-                default:
-                    status = start;
-                    break;
-            }
+            idx += stuffBytes(frame + 4, encoded, encodedSize, ctx->fcsType, NULL, &ctx->bytestuffCount);
         }
+        frame[idx++] = FLAG;
+        slot->size = idx;
+        return idx;
     }
-    return -1;
+
+    // COBS encodes the payload and frame check sequence as one data field, with no FLAG left in it
+    if (ctx->framing == FramingCobs)
+    {
+        int size = fcsWrite(ctx->fcsType, fcsCompute(ctx->fcsType, buf, bufSize), fcs);
+        CobsEncoder encoder;
+        cobsStart(&encoder, frame + 4);
+        cobsUpdate(&encoder, buf, bufSize);
+        cobsUpdate(&encoder, fcs, size);
+        int encoded = cobsFinish(&encoder);
+        ctx->bytestuffCount += encoded - bufSize - size;
+        frame[4 + encoded] = FLAG;
+        slot->size = 4 + encoded + 1;
+        return slot->size;
+    }
+
+    // stuff the payload, computing its frame check sequence in the same pass
+    uint32_t check = fcsStart(ctx->fcsType);
+    int idx = 4 + stuffBytes(frame + 4, buf, bufSize, ctx->fcsType, &check, &ctx->bytestuffCount);
+
+    // careful with stuffing for the frame check sequence too
+    int size = fcsWrite(ctx->fcsType, fcsFinish(ctx->fcsType, check), fcs);
+    idx += stuffBytes(frame + idx, fcs, size, ctx->fcsType, NULL, &ctx->bytestuffCount);
+
+    // terminate the frame
+    frame[idx++] = FLAG;
+    slot->size = idx;
+    return idx;
 }
 
+// Write the frame in slot to the serial port.
+// Returns -1 on error.
+int sendSlot(LinkContext *ctx, TxSlot *slot)
+{
+    ctx->transmissionCount++;
+    ctx->frameBytesSent += slot->size;
+    return serialWrite(&ctx->port, slot->frame, slot->size);
+}
 
-////////////////////////////////////////////////
-// LLCLOSE
-////////////////////////////////////////////////
-int llclose(int showStatistics)
+// Send a supervision frame (RR, REJ, RNR) answering the I frames of the other end.
+// Returns -1 on error.
+int sendSupervision(LinkContext *ctx, unsigned char control)
 {
-    // reset the alarm, good practice
-    alarmEnabled = FALSE;
-    alarmCount = 0;
-    alarm(0);
+    // RR(frameNumber) and RNR(frameNumber), and REJ(frameNumber) but with selective repeat, acknowledge every
+    // frame received so far, those whose acknowledgement was held back included
+    bool rnr = control == C_RNR(ctx->frameNumber);
+    if (control == C_RR(ctx->frameNumber) || rnr || (control == C_REJ(ctx->frameNumber) && ctx->arqMode != ArqSelectiveRepeat))
+    {
+        ctx->acksSaved += control != C_REJ(ctx->frameNumber) && ctx->unacked > 0 ? ctx->unacked - 1 : ctx->unacked;
+        ctx->unacked = 0;
+        ctx->ackPending = FALSE;
+    }
+    // any other answer tells the transmitter that we read again
+    ctx->rnrSent += rnr;
+    ctx->notReady = rnr;
+    traceEvent(ctx->port.fd, TraceSupervision, 0, 0, control);
+    unsigned char buf[BUFFER_SIZE] = {FLAG, ctx->peerAddress, control, ctx->peerAddress ^ control, FLAG};
+    return serialWrite(&ctx->port, buf, BUFFER_SIZE);
+}
 
-    char byte = 0;
-    statusReceived status = start;
+// With flow control, whether the application was slow to call llread lately, so that the transmitter had
+// better stop while the frame just received is handed over. Bytes waiting in the receive buffer are no sign
+// of it, a window of frames in flight leaves as many there.
+bool receiverBackedUp(LinkContext *ctx)
+{
+    return ctx->flowControl && ctx->slowReads > 0;
+}
 
-    if(role == LlTx)
+// Note how long the application took to call llread again since the last frame was delivered.
+void trackReader(LinkContext *ctx)
+{
+    if (!ctx->flowControl || ctx->deliveredAt == 0)
     {
-        (void)signal(SIGALRM, alarmHandler);
-        
-        // try to send disc while you don't receive a DISC back
-        while(nRetransmissions > alarmCount && status != done)
-        {
-            // build the frame
-            unsigned char buf[BUFFER_SIZE] = {FLAG, A_T, DISC, (A_T ^ DISC), FLAG};
-            if (writeBytes((char*)buf, BUFFER_SIZE) < 0)
-            {
-                printf("Error in llclose writebytes!\n");
-                return -1;
-            }
-            // set alarm
-            alarm(timeout);
-            alarmEnabled = TRUE;
-            // while alarm is enabled try to read the I frame (DISC) from the rx
-            while(alarmEnabled)
-            {
-                // read the byte from the serial port 
-                readBytes = readByte(&byte);
-                // in case of error, return error
-                if (readBytes < 0)
-                {
-                    printf("Read byte error on llclose transmitter side!\n");
-                    return -1;
-                }
-                // only if we read a byte do we go to state machine
-                if (readBytes != 0)
-                {
-                    switch (status)
-                    {
-                        case start:
-                            if(byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            break;
-                        case flagRCV:
-                            if (byte == A_R)
-                            {
-                                status = aRCV;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case aRCV:
-                            if (byte == DISC)
-                            {
-                                status = cRCV;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case cRCV:
-                            if(byte == (A_R ^ DISC))
-                            {
-                                status = bccOK;
-                            }
-                            else if (byte == FLAG)
-                            {
-                                status = flagRCV;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        case bccOK:
-                            if (byte == FLAG)
-                            {
-                                status = done;
-                                alarmEnabled = FALSE;
-                            }
-                            else
-                            {
-                                status = start;
-                            }
-                            break;
-                        default:
-                            status = start;
-                            break;
-                    }
-                }
-            }
-        }
-        // send an acknowledgement after disconnecting
-        unsigned char buf[BUFFER_SIZE] = {FLAG, A_R, UA, (A_R ^ UA), FLAG};
-        if (writeBytes((char *)buf, BUFFER_SIZE) < 0)
-        {
-            printf("Error in llclose writebytes!\n");
-            return -1;
-        }
+        return;
+    }
+    if (timerNow() - ctx->deliveredAt > SLOW_READER_MS)
+    {
+        ctx->slowReads = SLOW_READER_FRAMES;
     }
-    else if(role == LlRx)
+    else if (ctx->slowReads > 0)
     {
-        (void)signal(SIGALRM, alarmHandler);
+        ctx->slowReads--;
+    }
+}
 
-        // wait to receive an I (DISC) frame from tx
-        while(status != done)
-        {
-            readBytes = readByte(&byte);
-            if (readBytes < 0) 
-            {
-                printf("Read byte error on llclose receiver side!\n");
+// Acknowledge the frame just received in sequence with RR, or hold the acknowledgement back until ackEvery
+// frames are waiting for it or the port goes quiet. A receiver that is backed up answers RNR instead.
+// Returns -1 on error.
+int acknowledgeFrame(LinkContext *ctx)
+{
+    ctx->unacked++;
+    ctx->deliveredAt = timerNow();
+    // the frame goes to an application that may take long to call llread again, so the transmitter must only
+    // send what the receive buffer takes meanwhile, without timing out on it
+    if (receiverBackedUp(ctx))
+    {
+        return sendSupervision(ctx, C_RNR(ctx->frameNumber));
+    }
+    if (ctx->unacked < ctx->ackEvery)
+    {
+        ctx->ackPending = TRUE;
+        return 0;
+    }
+    return sendSupervision(ctx, C_RR(ctx->frameNumber));
+}
+
+// Control field of our full-duplex I frame seq, which carries the acknowledgement of everything received,
+// unless this end sent RNR: an acknowledgement would let the other end send again.
+unsigned char duplexControl(LinkContext *ctx, int seq)
+{
+    if (ctx->notReady)
+    {
+        return C_I(seq);
+    }
+    ctx->piggybackCount += ctx->ackPending;
+    ctx->ackPending = FALSE;
+    ctx->unacked = 0;
+    return C_I_ACK(seq, ctx->frameNumber);
+}
+
+// Start the retransmission timer, or the persist timer while the receiver is not ready.
+void startTimer(LinkContext *ctx)
+{
+    if (ctx->peerBusy)
+    {
+        timerPersist(&ctx->timer, ctx->persistDelay);
+    }
+    else
+    {
+        timerStart(&ctx->timer);
+    }
+    ctx->timerEnabled = TRUE;
+}
+
+// The receiver sent RNR: hold new frames until it reads again. It just answered, so the persist interval
+// starts over.
+void pauseSending(LinkContext *ctx)
+{
+    ctx->persistDelay = ctx->timer.rto > MIN_PERSIST_MS ? ctx->timer.rto : MIN_PERSIST_MS;
+    if (ctx->peerBusy)
+    {
+        return;
+    }
+    LOG_DEBUG("Receiver not ready, pausing.\n");
+    ctx->peerBusy = TRUE;
+    ctx->rnrReceived++;
+    ctx->pausedAt = timerNow();
+}
+
+// The receiver answered with RR or REJ, so it reads again.
+void resumeSending(LinkContext *ctx)
+{
+    if (!ctx->peerBusy)
+    {
+        return;
+    }
+    ctx->peerBusy = FALSE;
+    ctx->pausedTime += timerNow() - ctx->pausedAt;
+}
+
+////////////////////////////////////////////////
+// WINDOWED TRANSMITTER (GO-BACK-N, SELECTIVE REPEAT)
+////////////////////////////////////////////////
+
+// Write again the frame with sequence number seq.
+// Returns -1 on error.
+int resendFrame(LinkContext *ctx, int seq)
+{
+    TxSlot *slot = &ctx->txSlots[seq];
+    // in full duplex the copy carries the latest acknowledgement, the header is not stuffed so it is rewritten in place
+    if (ctx->duplex)
+    {
+        slot->frame[2] = duplexControl(ctx, seq);
+        slot->frame[3] = slot->frame[1] ^ slot->frame[2];
+    }
+    if (sendSlot(ctx, slot) < 0)
+    {
+        LOG_ERROR("Write byte error on window retransmission!\n");
+        return -1;
+    }
+    traceEvent(ctx->port.fd, TraceResend, seq, slot->size, 0);
+    timerSent(&ctx->timer, slot->size);
+    sizerSample(&ctx->sizer, slot->size, TRUE);
+    ctx->windowResent[seq] = TRUE;
+    ctx->retransmissionCount++;
+    return 0;
+}
+
+// Write again the count oldest unacknowledged frames and restart the timer.
+// Returns -1 on error.
+int resendWindow(LinkContext *ctx, int count)
+{
+    for (int i = 0; i < count && i < ctx->windowCount; i++)
+    {
+        if (resendFrame(ctx, (ctx->windowBase + i) % ctx->seqModulus) < 0)
+        {
+            return -1;
+        }
+    }
+    ctx->timerEnabled = ctx->windowCount > 0;
+    if (ctx->timerEnabled)
+    {
+        timerStart(&ctx->timer);
+    }
+    else
+    {
+        timerStop(&ctx->timer);
+    }
+    return 0;
+}
+
+// Probe a receiver that is not ready with the newest frame sent, which comes after the frames it still has
+// to read and which it answers as a repeated frame once it reads again, and restart the persist timer
+// with twice the interval.
+// Returns -1 on error.
+int probeReceiver(LinkContext *ctx)
+{
+    int seq = ctx->arqMode == ArqStopAndWait ? 1 - ctx->frameNumber
+                                             : (ctx->windowBase + ctx->windowCount - 1 + ctx->seqModulus) % ctx->seqModulus;
+    TxSlot *slot = &ctx->txSlots[seq];
+    if (ctx->duplex)
+    {
+        slot->frame[2] = duplexControl(ctx, seq);
+        slot->frame[3] = slot->frame[1] ^ slot->frame[2];
+    }
+    if (sendSlot(ctx, slot) < 0)
+    {
+        LOG_ERROR("Write byte error probing the receiver!\n");
+        return -1;
+    }
+    traceEvent(ctx->port.fd, TraceProbe, seq, slot->size, 0);
+    timerSent(&ctx->timer, slot->size);
+    ctx->windowResent[seq] = TRUE;
+    ctx->probeCount++;
+    ctx->persistDelay = ctx->persistDelay * 2 < MAX_PERSIST_MS ? ctx->persistDelay * 2 : MAX_PERSIST_MS;
+    startTimer(ctx);
+    return 0;
+}
+
+// Slide the window up to sequence number n, which the receiver expects next.
+// Returns the number of frames acknowledged, 0 if n is outside the window.
+int acknowledgeUpTo(LinkContext *ctx, int n)
+{
+    int acked = (n - ctx->windowBase + ctx->seqModulus) % ctx->seqModulus;
+    if (acked > ctx->windowCount)
+    {
+        return 0;
+    }
+    // the newest frame acknowledged gives a round-trip sample if it was only sent once
+    int newest = (n - 1 + ctx->seqModulus) % ctx->seqModulus;
+    if (acked > 0 && !ctx->windowResent[newest])
+    {
+        timerSample(&ctx->timer, timerNow() - ctx->windowSentAt[newest]);
+        histogramAdd(&ctx->rttHistogram, timerNow() - ctx->windowSentAt[newest]);
+    }
+    for (int i = 0; i < acked; i++)
+    {
+        int seq = (ctx->windowBase + i) % ctx->seqModulus;
+        TxSlot *slot = &ctx->txSlots[seq];
+        sizerSample(&ctx->sizer, slot->size, FALSE);
+        long latency = timerNow() - slot->builtAt;
+        histogramAdd(&ctx->latencyHistogram, latency);
+        traceEvent(ctx->port.fd, TraceAck, seq, slot->size, latency < UINT16_MAX ? latency : UINT16_MAX);
+    }
+    ctx->windowBase = n;
+    ctx->windowCount -= acked;
+    return acked;
+}
+
+// Process an answer. RR(n) and RNR(n) always acknowledge every frame before n, RNR also pauses sending.
+// With go-back-n REJ(n) does the same and makes the transmitter go back and resend from n,
+// with selective repeat REJ(n) only asks for frame n again.
+// Returns -1 on error.
+int handleAnswer(LinkContext *ctx, const FrameEvent *answer)
+{
+    int n = answer->sequence;
+
+    if (answer->type == FrameRnr)
+    {
+        acknowledgeUpTo(ctx, n);
+        ctx->timeoutCount = 0;
+        pauseSending(ctx);
+        startTimer(ctx);
+        return 0;
+    }
+    // any other answer means the receiver reads again, the frames in flight are timed from now on
+    if (ctx->peerBusy)
+    {
+        resumeSending(ctx);
+        ctx->timerEnabled = ctx->windowCount > 0;
+        if (ctx->timerEnabled)
+        {
+            timerStart(&ctx->timer);
+        }
+        else
+        {
+            timerStop(&ctx->timer);
+        }
+    }
+
+    if (ctx->arqMode == ArqSelectiveRepeat && answer->type == FrameRej)
+    {
+        if ((n - ctx->windowBase + ctx->seqModulus) % ctx->seqModulus >= ctx->windowCount)
+        {
+            return 0;
+        }
+        LOG_DEBUG("Rejected frame %d, resending it.\n", n);
+        ctx->rejRetransmissionCount++;
+        return resendFrame(ctx, n);
+    }
+
+    if (answer->type == FrameRej)
+    {
+        if (acknowledgeUpTo(ctx, n) == 0 && n != ctx->windowBase)
+        {
+            return 0;
+        }
+        ctx->timeoutCount = 0;
+        LOG_DEBUG("Rejected frame %d, going back.\n", n);
+        ctx->rejRetransmissionCount += ctx->windowCount;
+        return resendWindow(ctx, ctx->windowCount);
+    }
+
+    if (answer->type == FrameRr && acknowledgeUpTo(ctx, n) > 0)
+    {
+        // progress was made, restart the timer for the remaining frames
+        ctx->timeoutCount = 0;
+        if (ctx->windowCount > 0)
+        {
+            timerStart(&ctx->timer);
+            ctx->timerEnabled = TRUE;
+        }
+        else
+        {
+            timerStop(&ctx->timer);
+            ctx->timerEnabled = FALSE;
+        }
+    }
+    return 0;
+}
+
+// Check whether a byte can be read without waiting.
+bool byteAvailable(LinkContext *ctx)
+{
+    if (receivedCount(&ctx->receive) > 0)
+    {
+        return TRUE;
+    }
+    struct pollfd pfd = {.fd = ctx->port.fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Check that no byte arrives on the port for the given time, which is waited for.
+bool portQuiet(LinkContext *ctx, int milliseconds)
+{
+    struct pollfd pfd = {.fd = ctx->port.fd, .events = POLLIN};
+    return poll(&pfd, 1, milliseconds) == 0;
+}
+
+// Process the receiver answers and the retransmission timer of the open window.
+// If wait is TRUE, waits for the next received bytes or the timer, otherwise only consumes bytes already received.
+// Returns -1 on error or when the maximum number of retransmissions is reached.
+int serviceWindow(LinkContext *ctx, bool wait)
+{
+    // timer expired with frames still unacknowledged, go back and resend all of them,
+    // or only the oldest one with selective repeat; the persist timer expired, probe the receiver
+    if ((ctx->windowCount > 0 || ctx->peerBusy) && !ctx->timerEnabled)
+    {
+        if (ctx->timeoutCount >= ctx->nRetransmissions)
+        {
+            LOG_ERROR("Max retransmissions reached, aborting!\n");
+            return -1;
+        }
+        if (ctx->peerBusy ? probeReceiver(ctx) < 0 : resendWindow(ctx, ctx->arqMode == ArqSelectiveRepeat ? 1 : ctx->windowCount) < 0)
+        {
+            return -1;
+        }
+    }
+
+    while (wait || byteAvailable(ctx))
+    {
+        FrameEvent answer;
+        int result = nextFrame(ctx, &answer);
+        if (result < 0)
+        {
+            LOG_ERROR("Read byte error while waiting for answers!\n");
+            return -1;
+        }
+        if (result > 0 && answer.address == ctx->address && handleAnswer(ctx, &answer) < 0)
+        {
+            return -1;
+        }
+        if (result > 0 && ctx->duplex && answer.type == FrameI && answer.address == ctx->peerAddress &&
+            receiveDuplex(ctx, &answer) < 0)
+        {
+            return -1;
+        }
+        if (wait)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Windowed llwrite: queue the frame in the window and only block while the window is full.
+int llwriteWindow(LinkContext *ctx, const unsigned char *buf, int bufSize)
+{
+    // wait for room in the window, and while the receiver is not ready, for room in its receive buffer
+    while (ctx->windowCount >= ctx->windowSize || (ctx->peerBusy && ctx->windowCount >= ctx->receiveCredit))
+    {
+        if (serviceWindow(ctx, TRUE) < 0)
+        {
+            return -1;
+        }
+    }
+
+    int seq = (ctx->windowBase + ctx->windowCount) % ctx->seqModulus;
+    TxSlot *slot = &ctx->txSlots[seq];
+    // in full duplex the frame also acknowledges what the other end sent so far
+    int frameSize = buildIFrame(ctx, slot, buf, bufSize, ctx->duplex ? duplexControl(ctx, seq) : C_I(seq));
+    if (sendSlot(ctx, slot) < 0)
+    {
+        LOG_ERROR("Write byte error on llwrite!\n");
+        return -1;
+    }
+    traceEvent(ctx->port.fd, TraceSend, seq, frameSize, 0);
+    ctx->windowSentAt[seq] = timerSent(&ctx->timer, frameSize);
+    ctx->windowResent[seq] = FALSE;
+    ctx->windowCount++;
+
+    // first frame in flight starts the timer, the persist timer keeps running while the receiver is not ready
+    if (ctx->windowCount == 1 && !ctx->peerBusy)
+    {
+        timerStart(&ctx->timer);
+        ctx->timerEnabled = TRUE;
+        ctx->timeoutCount = 0;
+    }
+
+    // handle answers that already arrived, without blocking
+    if (serviceWindow(ctx, FALSE) < 0)
+    {
+        return -1;
+    }
+
+    ctx->llwriteCount++;
+    return frameSize;
+}
+
+// Wait until a receiver that is not ready reads again, probing it on the persist timer,
+// so that it does not miss the DISC.
+// Returns -1 on error.
+int waitReceiverReady(LinkContext *ctx)
+{
+    // stop-and-wait has nothing in flight and no timer running after the last frame was acknowledged
+    if (ctx->peerBusy && ctx->arqMode == ArqStopAndWait)
+    {
+        ctx->timeoutCount = 0;
+        startTimer(ctx);
+    }
+    while (ctx->peerBusy)
+    {
+        if (ctx->arqMode != ArqStopAndWait)
+        {
+            if (serviceWindow(ctx, TRUE) < 0)
+            {
                 return -1;
             }
-            if (readBytes != 0) 
+            continue;
+        }
+        if (ctx->timeoutCount >= ctx->nRetransmissions)
+        {
+            LOG_ERROR("Max retransmissions reached, aborting!\n");
+            return -1;
+        }
+        if (!ctx->timerEnabled && probeReceiver(ctx) < 0)
+        {
+            return -1;
+        }
+        FrameEvent answer;
+        int result = nextFrame(ctx, &answer);
+        if (result < 0)
+        {
+            LOG_ERROR("Read byte error while waiting for the receiver!\n");
+            return -1;
+        }
+        if (result > 0 && answer.address == ctx->address && (answer.type == FrameRr || answer.type == FrameRej))
+        {
+            resumeSending(ctx);
+        }
+    }
+    timerStop(&ctx->timer);
+    ctx->timerEnabled = FALSE;
+    return 0;
+}
+
+// Wait until every frame in the window is acknowledged.
+// Returns -1 on error.
+int flushWindow(LinkContext *ctx)
+{
+    while (ctx->windowCount > 0)
+    {
+        if (serviceWindow(ctx, TRUE) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// SELECTIVE REPEAT RECEIVER
+////////////////////////////////////////////////
+
+// Handle an I frame that arrived while waiting for frameNumber.
+// Frames ahead in the window are kept and every missing frame before them is asked for once with REJ(n),
+// frames behind were already delivered and only need to be acknowledged again.
+// Returns -1 on error.
+int reorderFrame(LinkContext *ctx, int sequence, const unsigned char *payload, int payloadSize, bool valid)
+{
+    if ((sequence - ctx->frameNumber + ctx->seqModulus) % ctx->seqModulus >= ctx->windowSize)
+    {
+        return sendSupervision(ctx, C_RR(ctx->frameNumber));
+    }
+
+    if (!valid)
+    {
+        LOG_DEBUG("BCC2 error!\n");
+        // the header is intact, so ask for this frame only
+        ctx->rejSent[sequence] = TRUE;
+        return sendSupervision(ctx, C_REJ(sequence));
+    }
+
+    if (!ctx->reorderFull[sequence])
+    {
+        memcpy(ctx->reorderSlots[sequence], payload, payloadSize);
+        ctx->reorderSizes[sequence] = payloadSize;
+        ctx->reorderFull[sequence] = TRUE;
+        ctx->rejSent[sequence] = FALSE;
+    }
+
+    for (int n = ctx->frameNumber; n != sequence; n = (n + 1) % ctx->seqModulus)
+    {
+        if (!ctx->reorderFull[n] && !ctx->rejSent[n])
+        {
+            ctx->rejSent[n] = TRUE;
+            if (sendSupervision(ctx, C_REJ(n)) < 0)
             {
-                switch (status)
-                {
-                    case start:
-                        if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        break;
-                    case flagRCV:
-                        if (byte == A_T)
-                        {
-                            status = aRCV;
-                        }
-                        else if (byte != FLAG)
-                        {
-                            status = start;
-                        }
-                        break;
-                    case aRCV:
-                        if (byte == DISC)
-                        {
-                            status = cRCV;
-                        }
-                        else if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        else
-                        {
-                            status = start;
-                        }
-                        break;
-                    case cRCV:
-                        if(byte == (A_T ^ DISC))
-                        {
-                            status = bccOK;
-                        }
-                        else if (byte == FLAG)
-                        {
-                            status = flagRCV;
-                        }
-                        else
-                        {
-                            status = start;
-                        }
-                        break;
-                    case bccOK:
-                        if (byte == FLAG)
-                        {
-                            status = done;
-                        }
-                        else
-                        {
-                            status = start;
-                        }
-                        break;
-                    default:
-                        status = start;
-                        break;
-                }
+                return -1;
             }
         }
+    }
+    return 0;
+}
 
-        // prepare DISC frame and status
-        unsigned char buf[BUFFER_SIZE] = {FLAG, A_R, DISC, (A_R ^ DISC), FLAG};
-        status = start;
+// Deliver the kept frame for frameNumber to the application and acknowledge it.
+// Returns the packet size, or -1 on error.
+int deliverReordered(LinkContext *ctx, unsigned char *packet)
+{
+    int packetSize = ctx->reorderSizes[ctx->frameNumber];
+    memcpy(packet, ctx->reorderSlots[ctx->frameNumber], packetSize);
+    ctx->reorderFull[ctx->frameNumber] = FALSE;
+    ctx->rejSent[ctx->frameNumber] = FALSE;
+    traceEvent(ctx->port.fd, TraceDeliver, ctx->frameNumber, packetSize, 0);
+    ctx->frameNumber = (ctx->frameNumber + 1) % ctx->seqModulus;
 
-        // after receiving one, send one back with you as author, waiting on the answer from the tx, keep sending them until UA
-        while (nRetransmissions > alarmCount && status != done)
+    if (acknowledgeFrame(ctx) < 0)
+    {
+        LOG_ERROR("Write bytes error on reply from rx, llread!\n");
+        return -1;
+    }
+    ctx->payloadBytesReceived += packetSize;
+    ctx->llreadCount++;
+    LOG_DEBUG("Reading done!\n");
+    return packetSize;
+}
+
+////////////////////////////////////////////////
+// FULL DUPLEX
+////////////////////////////////////////////////
+
+// Queue the payload of frame frameNumber for llread and acknowledge it, with the next I frame we send
+// or with an RR once the link is idle.
+void queueFrame(LinkContext *ctx, const unsigned char *payload, int payloadSize)
+{
+    int tail = (ctx->rxQueueHead + ctx->rxQueueCount) % RX_QUEUE_SIZE;
+    memcpy(ctx->rxQueue[tail], payload, payloadSize);
+    ctx->rxQueueSizes[tail] = payloadSize;
+    ctx->rxQueueCount++;
+    ctx->rejSent[ctx->frameNumber] = FALSE;
+    ctx->frameNumber = (ctx->frameNumber + 1) % ctx->seqModulus;
+    ctx->unacked++;
+    ctx->ackPending = TRUE;
+}
+
+// Queue the frames selective repeat kept ahead of frameNumber that are now in sequence, while there is room.
+void advanceQueue(LinkContext *ctx)
+{
+    while (ctx->reorderFull[ctx->frameNumber] && ctx->rxQueueCount < RX_QUEUE_SIZE)
+    {
+        ctx->reorderFull[ctx->frameNumber] = FALSE;
+        queueFrame(ctx, ctx->reorderSlots[ctx->frameNumber], ctx->reorderSizes[ctx->frameNumber]);
+    }
+}
+
+// Stop the other end with RNR once the queue has no room for a whole window more, with flow control.
+// Returns -1 on error.
+int stopWhenFull(LinkContext *ctx)
+{
+    if (!ctx->flowControl || ctx->notReady || RX_QUEUE_SIZE - ctx->rxQueueCount > ctx->windowSize)
+    {
+        return 0;
+    }
+    return sendSupervision(ctx, C_RNR(ctx->frameNumber));
+}
+
+// Handle an I frame from the other end of a full-duplex link, which may arrive while sending as well as in llread.
+// Its acknowledgement moves our window, and its payload is queued for llread as the ARQ mode allows.
+// A frame in sequence is dropped unanswered while the queue is full, the other end sends it again later,
+// and with flow control every frame is dropped and answered with RNR once we sent it.
+// Returns -1 on error.
+int receiveDuplex(LinkContext *ctx, const FrameEvent *frame)
+{
+    // only trust the acknowledgement of an intact frame, acknowledging a frame that was lost cannot be undone
+    if (frame->valid && frame->ack >= 0)
+    {
+        FrameEvent answer = {.type = FrameRr, .address = ctx->address, .sequence = frame->ack, .ack = -1, .valid = TRUE};
+        if (handleAnswer(ctx, &answer) < 0)
         {
-            if (!alarmEnabled)
+            return -1;
+        }
+    }
+
+    // the RNR may have been lost, or the frame was already on its way
+    if (ctx->notReady)
+    {
+        return sendSupervision(ctx, C_RNR(ctx->frameNumber));
+    }
+
+    // a frame already queued, whose acknowledgement got lost
+    if ((frame->sequence - ctx->frameNumber + ctx->seqModulus) % ctx->seqModulus >= ctx->windowSize)
+    {
+        ctx->duplicateCount++;
+        return sendSupervision(ctx, C_RR(ctx->frameNumber));
+    }
+
+    if (ctx->arqMode == ArqSelectiveRepeat)
+    {
+        if (reorderFrame(ctx, frame->sequence, ctx->frameBuffer, frame->payloadSize, frame->valid) < 0)
+        {
+            return -1;
+        }
+        advanceQueue(ctx);
+        return stopWhenFull(ctx);
+    }
+
+    if (frame->sequence == ctx->frameNumber && frame->valid)
+    {
+        if (ctx->rxQueueCount < RX_QUEUE_SIZE)
+        {
+            queueFrame(ctx, ctx->frameBuffer, frame->payloadSize);
+        }
+        return stopWhenFull(ctx);
+    }
+
+    // go-back-n rejects the expected frame whenever it arrives damaged, like llread, and asks once for it
+    // when a later frame arrives instead, then keeps answering RR
+    bool damaged = frame->sequence == ctx->frameNumber;
+    int control = !damaged && ctx->rejSent[ctx->frameNumber] ? C_RR(ctx->frameNumber) : C_REJ(ctx->frameNumber);
+    ctx->rejSent[ctx->frameNumber] = TRUE;
+    return sendSupervision(ctx, control);
+}
+
+// Full-duplex llread: return the oldest queued frame, servicing the window of our own I frames while waiting.
+// Returns the packet size, or -1 on error.
+int readQueued(LinkContext *ctx, unsigned char *packet)
+{
+    while (ctx->rxQueueCount == 0)
+    {
+        if (serviceWindow(ctx, TRUE) < 0)
+        {
+            return -1;
+        }
+    }
+
+    int packetSize = ctx->rxQueueSizes[ctx->rxQueueHead];
+    memcpy(packet, ctx->rxQueue[ctx->rxQueueHead], packetSize);
+    traceEvent(ctx->port.fd, TraceDeliver, 0, packetSize, 0);
+    ctx->rxQueueHead = (ctx->rxQueueHead + 1) % RX_QUEUE_SIZE;
+    ctx->rxQueueCount--;
+    advanceQueue(ctx);
+    // once the queue drained to a quarter, let the other end send again
+    if (ctx->notReady && ctx->rxQueueCount <= RX_QUEUE_SIZE / 4 && sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
+    {
+        LOG_ERROR("Write bytes error on reply from rx, llread!\n");
+        return -1;
+    }
+
+    ctx->payloadBytesReceived += packetSize;
+    ctx->llreadCount++;
+    return packetSize;
+}
+
+////////////////////////////////////////////////
+// LLREAD
+////////////////////////////////////////////////
+int llreadCtx(LinkContext *ctx, unsigned char *packet)
+{
+    if (ctx->duplex)
+    {
+        return readQueued(ctx, packet);
+    }
+    trackReader(ctx);
+
+    // selective repeat may already hold the next frame
+    if (ctx->arqMode == ArqSelectiveRepeat && ctx->reorderFull[ctx->frameNumber])
+    {
+        return deliverReordered(ctx, packet);
+    }
+
+    // after our RNR the transmitter waits to hear that we read again, unless a frame is already here to be answered
+    if (ctx->notReady && !byteAvailable(ctx) && sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
+    {
+        LOG_ERROR("Write bytes error on reply from rx, llread!\n");
+        return -1;
+    }
+
+    while (TRUE)
+    {
+        // decode the next frame from the serial port
+        FrameEvent frame;
+        int result = nextFrame(ctx, &frame);
+        // return error in case of error
+        if (result < 0)
+        {
+            LOG_ERROR("Read byte error on llread!\n");
+            return -1;
+        }
+        // a SET repeated because our UA got lost is answered again
+        if (result > 0 && frame.type == FrameSet && answerRepeated(ctx, &frame) < 0)
+        {
+            return -1;
+        }
+        // only I frames from the transmitter matter here, otherwise just keep waiting
+        if (result == 0 || frame.type != FrameI || frame.address != A_T)
+        {
+            continue;
+        }
+
+        // out of sequence frame
+        if (frame.sequence != ctx->frameNumber)
+        {
+            bool behind = (frame.sequence - ctx->frameNumber + ctx->seqModulus) % ctx->seqModulus >= ctx->windowSize;
+            if (ctx->arqMode == ArqSelectiveRepeat)
             {
-                if (writeBytes((char *)buf, BUFFER_SIZE) < 0)
+                // keep it until the missing frames arrive, and ask only for those
+                if (reorderFrame(ctx, frame.sequence, ctx->frameBuffer, frame.payloadSize, frame.valid) < 0)
                 {
-                    printf("Error in llclose writebytes!\n");
                     return -1;
                 }
-                alarm(timeout);
-                alarmEnabled = TRUE;
             }
-            readBytes = readByte(&byte);
-            if (readBytes < 0) 
+            else if (ctx->arqMode == ArqGoBackN && !behind)
+            {
+                // go-back-n drops it, asks once for the missing frame with REJ, then keeps answering RR
+                // so that retransmissions whose answer got lost still move the transmitter window
+                if (sendSupervision(ctx, ctx->rejSent[ctx->frameNumber] ? C_RR(ctx->frameNumber) : C_REJ(ctx->frameNumber)) < 0)
+                {
+                    LOG_ERROR("Write bytes error on reply from rx, llread!\n");
+                    return -1;
+                }
+                ctx->rejSent[ctx->frameNumber] = TRUE;
+            }
+            // with stop-and-wait it can only be the previous frame again, its RR got lost, and so is a go-back-n
+            // frame behind the window, e.g. a probe while we were not ready; discard it and acknowledge it again at once
+            else if (answerRepeated(ctx, &frame) < 0)
             {
-                printf("Read byte error on llclose receiver side waiting for UA!\n");
                 return -1;
             }
-            // read an UA frame to end with state machine, only if we receive
-            if (readBytes != 0)
+            continue;
+        }
+
+        // if the frame check sequence is good, flip frame number to request the next frame with a reply
+        if (frame.valid)
+        {
+            traceEvent(ctx->port.fd, TraceDeliver, ctx->frameNumber, frame.payloadSize, 0);
+            ctx->rejSent[ctx->frameNumber] = FALSE;
+            ctx->frameNumber = (ctx->frameNumber + 1) % ctx->seqModulus;
+            if (acknowledgeFrame(ctx) < 0)
             {
-                switch (status) 
-                {
-                    case start:
-                        if (byte == FLAG) 
-                        {
-                            status = flagRCV;
-                        }
-                        break;
-                    case flagRCV:
-                        if (byte == A_R) 
-                        {
-                            status = aRCV;
-                        } 
-                        else if (byte != FLAG) 
-                        {
-                            status = start;
-                        }
-                        break;
-                    case aRCV:
-                        if (byte == UA) 
-                        {
-                            status = cRCV;
-                        } 
-                        else if (byte == FLAG) 
-                        {
-                            status = flagRCV;
-                        } 
-                        else 
-                        {
-                            status = start;
-                        }
-                        break;
-                    case cRCV:
-                        if (byte == (A_R ^ UA)) 
-                        {
-                            status = bccOK;
-                        } 
-                        else if (byte == FLAG) 
-                        {
-                            status = flagRCV;
-                        } else {
-                            status = start;
-                        }
-                        break;
-                    case bccOK:
-                        if (byte == FLAG) 
-                        {
-                            status = done;
-                        } else 
-                        {
-                            status = start;
-                        }
-                        break;
-                    default:
-                        status = start;
-                        break;
-                }
+                LOG_ERROR("Write bytes error on reply from rx, llread!\n");
+                return -1;
+            }
+            memcpy(packet, ctx->frameBuffer, frame.payloadSize);
+            ctx->payloadBytesReceived += frame.payloadSize;
+            ctx->llreadCount++;
+            LOG_DEBUG("Reading done!\n");
+            return frame.payloadSize;
+        }
+        else
+        {
+            // If BCC2 is incorrect then send REJ, don't flip frame number cuz we reject the old one
+            LOG_DEBUG("BCC2 error!\n");
+            ctx->rejSent[ctx->frameNumber] = TRUE;
+            if (sendSupervision(ctx, C_REJ(ctx->frameNumber)) < 0)
+            {
+                LOG_ERROR("Write bytes error on rejection from rx, llread!\n");
+                return -1;
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+////////////////////////////////////////////////
+// LLCLOSE
+////////////////////////////////////////////////
+int llcloseCtx(LinkContext *ctx, int showStatistics)
+{
+    // after our RNR the other end waits for us to read again, in full duplex while we may wait for it
+    if (ctx->notReady && sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
+    {
+        LOG_ERROR("Error in llclose writebytes!\n");
+        return -1;
+    }
+    // frames still in the window must be acknowledged before disconnecting
+    if ((ctx->role == LlTx || ctx->duplex) && ctx->arqMode != ArqStopAndWait && flushWindow(ctx) < 0)
+    {
+        LOG_ERROR("Error flushing the window on llclose!\n");
+        return -1;
+    }
+    // the other end may still wait for the acknowledgement of its last frames, held back or meant to ride on
+    // an I frame in full duplex, which must not come after the DISC it is not looking for yet
+    if (ctx->ackPending && sendSupervision(ctx, C_RR(ctx->frameNumber)) < 0)
+    {
+        LOG_ERROR("Error in llclose writebytes!\n");
+        return -1;
+    }
+    // a receiver that is not ready would not read the DISC in time
+    if ((ctx->role == LlTx || ctx->duplex) && waitReceiverReady(ctx) < 0)
+    {
+        LOG_ERROR("Error waiting for the receiver on llclose!\n");
+        return -1;
+    }
+
+    // reset the timer, good practice
+    ctx->timerEnabled = FALSE;
+    ctx->timeoutCount = 0;
+    timerStop(&ctx->timer);
+
+    int status = 0;
+
+    if(ctx->role == LlTx)
+    {
+
+        // try to send disc while you don't receive a DISC back
+        while(ctx->nRetransmissions > ctx->timeoutCount && status != 1)
+        {
+            // build the frame
+            unsigned char buf[BUFFER_SIZE] = {FLAG, A_T, DISC, (A_T ^ DISC), FLAG};
+            if (serialWrite(&ctx->port, buf, BUFFER_SIZE) < 0)
+            {
+                LOG_ERROR("Error in llclose writebytes!\n");
+                return -1;
+            }
+            // start the timer
+            timerStart(&ctx->timer);
+            ctx->timerEnabled = TRUE;
+            // while the timer runs try to read the DISC from the rx
+            status = waitFrame(ctx, FrameDisc, A_R, TRUE, NULL);
+            if (status < 0)
+            {
+                LOG_ERROR("Read byte error on llclose transmitter side!\n");
+                return -1;
             }
         }
+        timerStop(&ctx->timer);
+        ctx->timerEnabled = FALSE;
+        // send an acknowledgement after disconnecting
+        unsigned char buf[BUFFER_SIZE] = {FLAG, A_R, UA, (A_R ^ UA), FLAG};
+        if (serialWrite(&ctx->port, buf, BUFFER_SIZE) < 0)
+        {
+            LOG_ERROR("Error in llclose writebytes!\n");
+            return -1;
+        }
+    }
+    else if(ctx->role == LlRx)
+    {
+
+        // wait to receive a DISC frame from tx
+        if (waitFrame(ctx, FrameDisc, A_T, FALSE, NULL) < 0)
+        {
+            LOG_ERROR("Read byte error on llclose receiver side!\n");
+            return -1;
+        }
+
+        // prepare DISC frame
+        unsigned char buf[BUFFER_SIZE] = {FLAG, A_R, DISC, (A_R ^ DISC), FLAG};
+
+        // after receiving one, send one back with you as author, waiting on the answer from the tx, keep sending them until UA
+        while (ctx->nRetransmissions > ctx->timeoutCount && status != 1)
+        {
+            if (serialWrite(&ctx->port, buf, BUFFER_SIZE) < 0)
+            {
+                LOG_ERROR("Error in llclose writebytes!\n");
+                return -1;
+            }
+            timerStart(&ctx->timer);
+            ctx->timerEnabled = TRUE;
+            status = waitFrame(ctx, FrameUa, A_R, TRUE, NULL);
+            if (status < 0)
+            {
+                LOG_ERROR("Read byte error on llclose receiver side waiting for UA!\n");
+                return -1;
+            }
+        }
+        timerStop(&ctx->timer);
+        ctx->timerEnabled = FALSE;
     }
     else
     {
-        printf("Invalid role on llclose!\n");
+        LOG_ERROR("Invalid role on llclose!\n");
         return -1;
     }
-    
-    llcloseCount++;
+
+    ctx->llcloseCount++;
+    ctx->closedAt = timerNow();
 
     if (showStatistics)
     {
-        printf("llopen was called %d times\n", llopenCount);
-        printf("llwrite was called %d times\n", llwriteCount);
-        printf("llread was called %d times\n", llreadCount);
-        printf("llclose was called %d times\n", llcloseCount);
-        printf("%d bytes were stuffed\n", bytestuffCount);
-        printf("%d information bytes were read (not counting stuffing)\n", byteCount);
+        LOG_INFO("llopen was called %d times\n", ctx->llopenCount);
+        LOG_INFO("llwrite was called %d times\n", ctx->llwriteCount);
+        LOG_INFO("llread was called %d times\n", ctx->llreadCount);
+        LOG_INFO("llclose was called %d times\n", ctx->llcloseCount);
+        LOG_INFO("%d bytes were stuffed\n", ctx->bytestuffCount + ctx->decoder.escapes);
+        LOG_INFO("%d I frames were retransmitted, %d of them after a REJ\n", ctx->retransmissionCount, ctx->rejRetransmissionCount);
+        LOG_INFO("%d repeated I frames were acknowledged again\n", ctx->duplicateCount);
+        if (ctx->duplex)
+        {
+            LOG_INFO("%d acknowledgements were carried by I frames\n", ctx->piggybackCount);
+        }
+        LOG_INFO("%d RR frames were saved by cumulative acknowledgements\n", ctx->acksSaved);
+        if (ctx->flowControl)
+        {
+            LOG_INFO("%d RNR frames were sent and %d received, sending was paused for %ld ms with %d probes\n",
+                   ctx->rnrSent, ctx->rnrReceived, ctx->pausedTime, ctx->probeCount);
+        }
+        int expiries, rto, srtt;
+        long lostTime;
+        timerStats(&ctx->timer, &expiries, &lostTime, &rto, &srtt);
+        LOG_INFO("%d retransmission timeouts, %ld ms lost waiting for them\n", expiries, lostTime);
+        LOG_INFO("Final retransmission timeout %d ms, smoothed round-trip time %d ms\n", rto, srtt);
+        if (ctx->role == LlTx)
+        {
+            LOG_INFO("%.1f%% of I frame transmissions failed lately, best payload size %d bytes\n",
+                   ctx->sizer.errorRate * 100, llpayloadsizeCtx(ctx));
+        }
+        LOG_INFO("%d frames were dropped with a BCC1 error, %d had a BCC2 error\n", ctx->decoder.bcc1Errors, ctx->decoder.fcsErrors);
+        if (ctx->fec != FecNone)
+        {
+            LOG_INFO("%d bytes were corrected by error correction, %d frames had too many errors to correct\n",
+                   ctx->decoder.fecCorrected, ctx->decoder.fecFailures);
+        }
+        if (ctx->compression != CompressionNone)
+        {
+            LOG_INFO("%ld payload bytes were sent as %ld (%.1f%%), %d frames did not shrink, compressing took %ld us of CPU\n",
+                   ctx->plainBytesSent, ctx->packedBytesSent, ctx->plainBytesSent > 0 ? 100.0 * ctx->packedBytesSent / ctx->plainBytesSent : 100.0,
+                   ctx->rawFrameCount, ctx->compressTime);
+            LOG_INFO("%ld compressed payload bytes were received as %ld, decompressing took %ld us of CPU\n",
+                   ctx->packedBytesReceived, ctx->plainBytesReceived, ctx->decompressTime);
+        }
+        LOG_INFO("%ld information bytes were sent and %ld read (not counting stuffing)\n", ctx->payloadBytesSent, ctx->payloadBytesReceived);
+        // goodput since llopen, against what the baud rate carries on a tty
+        long elapsed = ctx->closedAt - ctx->openedAt;
+        double goodput = elapsed > 0 ? (ctx->payloadBytesSent + ctx->payloadBytesReceived) * 1000.0 / elapsed : 0.0;
+        if (ctx->timer.byteTime > 0)
+        {
+            LOG_INFO("Effective throughput %.0f bytes/s over %ld ms, the link carries %ld bytes/s\n",
+                   goodput, elapsed, 1000000000L / ctx->timer.byteTime);
+        }
+        else
+        {
+            LOG_INFO("Effective throughput %.0f bytes/s over %ld ms\n", goodput, elapsed);
+        }
+        if (ctx->rttHistogram.samples > 0)
+        {
+            LOG_INFO("Round-trip time %ld ms on average, %ld ms at most\n",
+                   ctx->rttHistogram.sum / ctx->rttHistogram.samples, ctx->rttHistogram.max);
+        }
+        if (ctx->latencyHistogram.samples > 0)
+        {
+            LOG_INFO("I frames were acknowledged %ld ms after llwrite on average, %ld ms at most\n",
+                   ctx->latencyHistogram.sum / ctx->latencyHistogram.samples, ctx->latencyHistogram.max);
+        }
+        long readCalls, bytesReceived;
+        receiveBufferStats(&ctx->receive, &readCalls, &bytesReceived);
+        LOG_INFO("%ld bytes were received in %ld read calls\n", bytesReceived, readCalls);
     }
 
-    printf("LLCLOSE done!\n");
-    return closeSerialPort();
+    timerClose(&ctx->timer);
+    LOG_INFO("LLCLOSE done!\n");
+    traceEvent(ctx->port.fd, TraceClose, 0, 0, 0);
+    if (traceDump() < 0)
+    {
+        LOG_ERROR("Error writing the link trace on llclose!\n");
+    }
+    return serialClose(&ctx->port);
 }
@@ -0,0 +1,145 @@
+// Link statistics implementation
+
+#include "link_stats.h"
+#include "link_layer.h"
+
+// room for the scalar fields of a snapshot
+#define STATS_FIELDS 32
+
+void histogramAdd(Histogram *histogram, long milliseconds)
+{
+    // round-trip times are counted from when the frame should have left the port, an early answer is no time at all
+    milliseconds = milliseconds > 0 ? milliseconds : 0;
+    int bucket = 0;
+    while (bucket < STATS_BUCKETS - 1 && milliseconds >= 1L << bucket)
+    {
+        bucket++;
+    }
+    histogram->counts[bucket]++;
+    histogram->samples++;
+    histogram->sum += milliseconds;
+    histogram->max = milliseconds > histogram->max ? milliseconds : histogram->max;
+}
+
+// Append a field to the lists of names and values, which hold count fields so far.
+// Returns the new count.
+int addField(const char **names, long *values, int count, const char *name, long value)
+{
+    names[count] = name;
+    values[count] = value;
+    return count + 1;
+}
+
+// List the scalar fields of stats by name, in the order both formats write them.
+// Returns the number of fields.
+int statsFields(const LinkStats *stats, const char **names, long *values)
+{
+    int n = 0;
+    n = addField(names, values, n, "role", stats->role);
+    n = addField(names, values, n, "arq_mode", stats->options.arqMode);
+    n = addField(names, values, n, "window_size", stats->options.windowSize);
+    n = addField(names, values, n, "fcs", stats->options.fcsType);
+    n = addField(names, values, n, "framing", stats->options.framing);
+    n = addField(names, values, n, "fec", stats->options.fec);
+    n = addField(names, values, n, "compression", stats->options.compression);
+    n = addField(names, values, n, "duplex", stats->options.duplex);
+    n = addField(names, values, n, "flow_control", stats->options.flowControl);
+    n = addField(names, values, n, "max_payload_size", stats->options.maxPayloadSize);
+    n = addField(names, values, n, "elapsed_ms", stats->elapsed);
+    n = addField(names, values, n, "frames_sent", stats->framesSent);
+    n = addField(names, values, n, "transmissions", stats->transmissions);
+    n = addField(names, values, n, "timeout_retransmissions", stats->timeoutRetransmissions);
+    n = addField(names, values, n, "rej_retransmissions", stats->rejRetransmissions);
+    n = addField(names, values, n, "probes", stats->probes);
+    n = addField(names, values, n, "timeouts", stats->timeouts);
+    n = addField(names, values, n, "payload_bytes_sent", stats->payloadBytesSent);
+    n = addField(names, values, n, "frame_bytes_sent", stats->frameBytesSent);
+    n = addField(names, values, n, "wire_bytes_sent", stats->wireBytesSent);
+    n = addField(names, values, n, "stuffing_bytes_sent", stats->stuffingBytesSent);
+    n = addField(names, values, n, "frames_received", stats->framesReceived);
+    n = addField(names, values, n, "duplicates", stats->duplicates);
+    n = addField(names, values, n, "bcc1_errors", stats->bcc1Errors);
+    n = addField(names, values, n, "bcc2_errors", stats->bcc2Errors);
+    n = addField(names, values, n, "payload_bytes_received", stats->payloadBytesReceived);
+    n = addField(names, values, n, "wire_bytes_received", stats->wireBytesReceived);
+    n = addField(names, values, n, "stuffing_bytes_received", stats->stuffingBytesReceived);
+    n = addField(names, values, n, "rto_ms", stats->rto);
+    n = addField(names, values, n, "srtt_ms", stats->srtt);
+    return n;
+}
+
+// Write a histogram as a JSON object.
+void writeHistogramJson(const char *name, const Histogram *histogram, FILE *out)
+{
+    fprintf(out, "  \"%s\": {\"samples\": %ld, \"sum_ms\": %ld, \"max_ms\": %ld, \"buckets\": [",
+            name, histogram->samples, histogram->sum, histogram->max);
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        fprintf(out, i > 0 ? ", %ld" : "%ld", histogram->counts[i]);
+    }
+    fprintf(out, "]}");
+}
+
+int statsWriteJson(const LinkStats *stats, FILE *out)
+{
+    const char *names[STATS_FIELDS];
+    long values[STATS_FIELDS];
+    int count = statsFields(stats, names, values);
+
+    fprintf(out, "{\n");
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, "  \"%s\": %ld,\n", names[i], values[i]);
+    }
+    writeHistogramJson("rtt", &stats->rtt, out);
+    fprintf(out, ",\n");
+    writeHistogramJson("latency", &stats->latency, out);
+    fprintf(out, "\n}\n");
+    return ferror(out) ? -1 : 0;
+}
+
+// Write the column names or the values of a histogram, each bucket named after the bound it stays under.
+void writeHistogramCsv(const char *name, const Histogram *histogram, FILE *out, bool header)
+{
+    if (header)
+    {
+        fprintf(out, ",%s_samples,%s_sum_ms,%s_max_ms", name, name, name);
+        for (int i = 0; i < STATS_BUCKETS - 1; i++)
+        {
+            fprintf(out, ",%s_under_%ld_ms", name, 1L << i);
+        }
+        fprintf(out, ",%s_from_%ld_ms", name, 1L << (STATS_BUCKETS - 2));
+        return;
+    }
+    fprintf(out, ",%ld,%ld,%ld", histogram->samples, histogram->sum, histogram->max);
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        fprintf(out, ",%ld", histogram->counts[i]);
+    }
+}
+
+int statsWriteCsv(const LinkStats *stats, FILE *out, bool header)
+{
+    const char *names[STATS_FIELDS];
+    long values[STATS_FIELDS];
+    int count = statsFields(stats, names, values);
+
+    if (header)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, i > 0 ? ",%s" : "%s", names[i]);
+        }
+        writeHistogramCsv("rtt", &stats->rtt, out, TRUE);
+        writeHistogramCsv("latency", &stats->latency, out, TRUE);
+        fprintf(out, "\n");
+    }
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, i > 0 ? ",%ld" : "%ld", values[i]);
+    }
+    writeHistogramCsv("rtt", &stats->rtt, out, FALSE);
+    writeHistogramCsv("latency", &stats->latency, out, FALSE);
+    fprintf(out, "\n");
+    return ferror(out) ? -1 : 0;
+}
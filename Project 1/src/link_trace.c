@@ -0,0 +1,157 @@
+// Link trace implementation
+
+#include "link_trace.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+TraceEvent traceRing[TRACE_EVENTS];
+// events recorded so far, event i being in traceRing[i % TRACE_EVENTS]
+atomic_ulong traceCount = 0;
+// file traceDump writes to, empty for none
+char traceFile[256] = "";
+
+void traceEvent(int link, TraceType type, int sequence, int length, int value)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long index = atomic_fetch_add_explicit(&traceCount, 1, memory_order_relaxed);
+    TraceEvent *event = &traceRing[index % TRACE_EVENTS];
+    event->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    event->link = link;
+    event->length = length;
+    event->type = type;
+    event->sequence = sequence;
+    event->value = value;
+
+#ifdef LINK_PROBES
+    uint64_t time = event->time;
+    switch (type)
+    {
+        case TraceOpen:
+            DTRACE_PROBE5(link, open, link, sequence, length, value, time);
+            break;
+        case TraceClose:
+            DTRACE_PROBE5(link, close, link, sequence, length, value, time);
+            break;
+        case TraceSend:
+            DTRACE_PROBE5(link, frame_sent, link, sequence, length, value, time);
+            break;
+        case TraceResend:
+            DTRACE_PROBE5(link, frame_resent, link, sequence, length, value, time);
+            break;
+        case TraceProbe:
+            DTRACE_PROBE5(link, frame_probe, link, sequence, length, value, time);
+            break;
+        case TraceTimeout:
+            DTRACE_PROBE5(link, timeout, link, sequence, length, value, time);
+            break;
+        case TraceFrame:
+            DTRACE_PROBE5(link, frame_received, link, sequence, length, value, time);
+            break;
+        case TraceBadFrame:
+            DTRACE_PROBE5(link, bcc2_error, link, sequence, length, value, time);
+            break;
+        case TraceSupervision:
+            DTRACE_PROBE5(link, supervision_sent, link, sequence, length, value, time);
+            break;
+        case TraceDeliver:
+            DTRACE_PROBE5(link, delivered, link, sequence, length, value, time);
+            break;
+        case TraceFrameStart:
+            DTRACE_PROBE5(link, frame_start, link, sequence, length, value, time);
+            break;
+        case TraceBcc1Error:
+            DTRACE_PROBE5(link, bcc1_error, link, sequence, length, value, time);
+            break;
+        case TraceAck:
+            DTRACE_PROBE5(link, frame_acked, link, sequence, length, value, time);
+            break;
+    }
+#endif
+}
+
+// Write all of size bytes.
+// Returns -1 on error.
+int writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int traceDump(void)
+{
+    if (traceFile[0] == '\0')
+    {
+        return 0;
+    }
+    int fd = open(traceFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    unsigned long count = atomic_load_explicit(&traceCount, memory_order_acquire);
+    unsigned long first = count > TRACE_EVENTS ? count - TRACE_EVENTS : 0;
+    uint32_t header[2] = {sizeof(TraceEvent), count - first};
+    int start = first % TRACE_EVENTS;
+    int end = count % TRACE_EVENTS;
+    int status = writeAll(fd, TRACE_MAGIC, 8);
+    status |= writeAll(fd, header, sizeof(header));
+    // the oldest events are at the end of the array once the ring has wrapped
+    if (count > 0 && start >= end)
+    {
+        status |= writeAll(fd, traceRing + start, (TRACE_EVENTS - start) * sizeof(TraceEvent));
+        start = 0;
+    }
+    status |= writeAll(fd, traceRing + start, (end - start) * sizeof(TraceEvent));
+    status |= close(fd);
+    return status < 0 ? -1 : 0;
+}
+
+// Dump the trace when the process is interrupted.
+void traceSignal(int signal)
+{
+    traceDump();
+    if (signal != SIGUSR1)
+    {
+        // end the process the way the signal would have
+        struct sigaction action = {0};
+        action.sa_handler = SIG_DFL;
+        sigaction(signal, &action, NULL);
+        raise(signal);
+    }
+}
+
+int traceSetFile(const char *path)
+{
+    if (strlen(path) >= sizeof(traceFile))
+    {
+        return -1;
+    }
+    strcpy(traceFile, path);
+
+    struct sigaction action = {0};
+    action.sa_handler = traceSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGINT, &action, NULL) < 0 || sigaction(SIGTERM, &action, NULL) < 0 ||
+        sigaction(SIGUSR1, &action, NULL) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
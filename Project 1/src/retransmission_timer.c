@@ -0,0 +1,168 @@
+// Retransmission timer implementation
+
+#include "retransmission_timer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+int timerOpen(RetransmissionTimer *timer, int initialRto, int baudRate)
+{
+    timerClose(timer);
+    memset(timer, 0, sizeof(*timer));
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd < 0)
+    {
+        return -1;
+    }
+    timer->open = true;
+    timer->rto = initialRto < MIN_RTO_MS ? MIN_RTO_MS : initialRto > MAX_RTO_MS ? MAX_RTO_MS : initialRto;
+    timer->byteTime = baudRate > 0 ? 10000000000L / baudRate : 0;
+    return 0;
+}
+
+void timerClose(RetransmissionTimer *timer)
+{
+    if (timer->open)
+    {
+        close(timer->fd);
+        timer->open = false;
+    }
+    timer->expectedAt = 0;
+}
+
+long timerSent(RetransmissionTimer *timer, int bytes)
+{
+    long now = timerNow();
+    if (timer->linkFreeAt < now)
+    {
+        timer->linkFreeAt = now;
+    }
+    timer->linkFreeAt += (bytes * timer->byteTime + 999999) / 1000000;
+    return timer->linkFreeAt;
+}
+
+void timerSetAnswerDelay(RetransmissionTimer *timer, int bytes)
+{
+    timer->answerDelay = (bytes * timer->byteTime + 999999) / 1000000;
+}
+
+// Arm the timer to expire milliseconds after the port is idle.
+void timerArm(RetransmissionTimer *timer, long milliseconds)
+{
+    long now = timerNow();
+    timer->expectedAt = timer->linkFreeAt > now ? timer->linkFreeAt : now;
+    long wait = timer->expectedAt - now + milliseconds;
+
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = wait / 1000;
+    spec.it_value.tv_nsec = (wait % 1000) * 1000000L;
+    timerfd_settime(timer->fd, 0, &spec, NULL);
+}
+
+void timerStart(RetransmissionTimer *timer)
+{
+    timer->persist = false;
+    timerArm(timer, timer->rto + timer->answerDelay);
+}
+
+void timerPersist(RetransmissionTimer *timer, int milliseconds)
+{
+    timer->persist = true;
+    timerArm(timer, milliseconds);
+}
+
+void timerStop(RetransmissionTimer *timer)
+{
+    struct itimerspec spec = {0};
+    timerfd_settime(timer->fd, 0, &spec, NULL);
+    timer->expectedAt = 0;
+    timer->persist = false;
+}
+
+int timerWait(RetransmissionTimer *timer, int fd)
+{
+    struct pollfd pfds[2] = {{.fd = fd, .events = POLLIN}, {.fd = timer->fd, .events = POLLIN}};
+    while (1)
+    {
+        // without a running timer only the port is waited on
+        if (poll(pfds, timer->expectedAt != 0 ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (timer->expectedAt != 0 && (pfds[1].revents & POLLIN))
+        {
+            uint64_t expirations;
+            if (read(timer->fd, &expirations, sizeof(expirations)) > 0)
+            {
+                if (!timer->persist)
+                {
+                    timer->expiryCount++;
+                    timer->lostTime += timerNow() - timer->expectedAt;
+                    timer->rto = timer->rto * 2 > MAX_RTO_MS ? MAX_RTO_MS : timer->rto * 2;
+                }
+                timer->expectedAt = 0;
+                timer->persist = false;
+                return 0;
+            }
+        }
+        if (pfds[0].revents)
+        {
+            return 1;
+        }
+    }
+}
+
+long timerNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+void timerSample(RetransmissionTimer *timer, long rtt)
+{
+    if (rtt < 1)
+    {
+        rtt = 1;
+    }
+
+    if (timer->srtt == 0)
+    {
+        timer->srtt = rtt;
+        timer->rttvar = rtt / 2;
+    }
+    else
+    {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+        long delta = timer->srtt > rtt ? timer->srtt - rtt : rtt - timer->srtt;
+        timer->rttvar = (3 * timer->rttvar + delta) / 4;
+        timer->srtt = (7 * timer->srtt + rtt) / 8;
+        if (timer->srtt < 1)
+        {
+            timer->srtt = 1;
+        }
+    }
+
+    // RTO = SRTT + max(G, 4 RTTVAR), the clock granularity G being 1 ms
+    int variance = 4 * timer->rttvar > 1 ? 4 * timer->rttvar : 1;
+    int rto = timer->srtt + variance;
+    timer->rto = rto < MIN_RTO_MS ? MIN_RTO_MS : rto > MAX_RTO_MS ? MAX_RTO_MS : rto;
+}
+
+void timerStats(const RetransmissionTimer *timer, int *expiries, long *lost, int *timeout, int *smoothedRtt)
+{
+    *expiries = timer->expiryCount;
+    *lost = timer->lostTime;
+    *timeout = timer->rto;
+    *smoothedRtt = timer->srtt;
+}
@@ -0,0 +1,44 @@
+// Serial port baud rate implementation
+
+#include "serial_baud.h"
+
+#include <asm/termbits.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+
+int setBaudRate(int fd, int baudRate)
+{
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baudRate;
+    tio.c_ospeed = baudRate;
+    // the input rate follows the output one
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    if (ioctl(fd, TCSETS2, &tio) < 0)
+    {
+        perror("TCSETS2");
+        return -1;
+    }
+
+    // the driver rounds to what its clock divides to, read back what it took
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+    long error = (long)tio.c_ospeed - baudRate;
+    if (error * 50 > baudRate || -error * 50 > baudRate)
+    {
+        fprintf(stderr, "Baud rate %d is not supported by the port, it runs at %u\n", baudRate, tio.c_ospeed);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
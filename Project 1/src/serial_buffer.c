@@ -0,0 +1,78 @@
+// Buffered serial port receive implementation
+
+#include "serial_buffer.h"
+
+#include <errno.h>
+
+void resetReceiveBuffer(ReceiveBuffer *buffer, SerialPort *port)
+{
+    buffer->port = port;
+    buffer->start = 0;
+    buffer->count = 0;
+}
+
+int fillReceiveBuffer(ReceiveBuffer *buffer)
+{
+    // keep the free space contiguous when the buffer is drained
+    if (buffer->count == 0)
+    {
+        buffer->start = 0;
+    }
+    if (buffer->count == RECEIVE_BUFFER_SIZE)
+    {
+        return 0;
+    }
+
+    // read into the free region up to the end of the array, the next call wraps around
+    int end = (buffer->start + buffer->count) % RECEIVE_BUFFER_SIZE;
+    int room = end < buffer->start ? buffer->start - end : RECEIVE_BUFFER_SIZE - end;
+
+    int bytes = serialRead(buffer->port, buffer->data + end, room);
+    buffer->readCalls++;
+    if (bytes < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    buffer->count += bytes;
+    buffer->bytesReceived += bytes;
+    return bytes;
+}
+
+int receivedSpan(const ReceiveBuffer *buffer, const unsigned char **span)
+{
+    *span = buffer->data + buffer->start;
+    int contiguous = RECEIVE_BUFFER_SIZE - buffer->start;
+    return buffer->count < contiguous ? buffer->count : contiguous;
+}
+
+void consumeReceived(ReceiveBuffer *buffer, int count)
+{
+    buffer->start = (buffer->start + count) % RECEIVE_BUFFER_SIZE;
+    buffer->count -= count;
+}
+
+int receivedCount(const ReceiveBuffer *buffer)
+{
+    return buffer->count;
+}
+
+int readBufferedByte(ReceiveBuffer *buffer, char *byte)
+{
+    if (buffer->count == 0)
+    {
+        int bytes = fillReceiveBuffer(buffer);
+        if (bytes <= 0)
+        {
+            return bytes;
+        }
+    }
+    *byte = buffer->data[buffer->start];
+    consumeReceived(buffer, 1);
+    return 1;
+}
+
+void receiveBufferStats(const ReceiveBuffer *buffer, long *readCalls, long *bytesReceived)
+{
+    *readCalls = buffer->readCalls;
+    *bytesReceived = buffer->bytesReceived;
+}
@@ -0,0 +1,161 @@
+// Re-entrant serial port implementation
+
+#include "serial_context.h"
+#include "serial_baud.h"
+#include "transport.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Open and configure a tty, at any baud rate up to MAX_BAUD_RATE, see serial_baud.h.
+// Returns the file descriptor, or -1 on error.
+int ttyOpen(SerialPort *port, const char *serialPort, int baudRate)
+{
+    // Convert baud rate to appropriate flag
+    tcflag_t br;
+    switch (baudRate)
+    {
+        case 1200: br = B1200; break;
+        case 1800: br = B1800; break;
+        case 2400: br = B2400; break;
+        case 4800: br = B4800; break;
+        case 9600: br = B9600; break;
+        case 19200: br = B19200; break;
+        case 38400: br = B38400; break;
+        case 57600: br = B57600; break;
+        case 115200: br = B115200; break;
+        case 230400: br = B230400; break;
+        case 460800: br = B460800; break;
+        case 500000: br = B500000; break;
+        case 576000: br = B576000; break;
+        case 921600: br = B921600; break;
+        case 1000000: br = B1000000; break;
+        case 1152000: br = B1152000; break;
+        case 1500000: br = B1500000; break;
+        case 2000000: br = B2000000; break;
+        case 2500000: br = B2500000; break;
+        case 3000000: br = B3000000; break;
+        case 3500000: br = B3500000; break;
+        case 4000000: br = B4000000; break;
+        default:
+            if (baudRate < 1200 || baudRate > MAX_BAUD_RATE)
+            {
+                fprintf(stderr, "Unsupported baud rate (must be from 1200 to %d)\n", MAX_BAUD_RATE);
+                return -1;
+            }
+            // set through termios2 once the port is configured
+            br = B38400;
+            break;
+    }
+
+    // Open with O_NONBLOCK to avoid hanging when CLOCAL is not yet set on the serial port
+    int oflags = O_RDWR | O_NOCTTY | O_NONBLOCK;
+    port->fd = open(serialPort, oflags);
+    if (port->fd < 0)
+    {
+        perror(serialPort);
+        return -1;
+    }
+
+    if (tcgetattr(port->fd, &port->oldtio) == -1)
+    {
+        perror("tcgetattr");
+        close(port->fd);
+        return -1;
+    }
+
+    // non-canonical, no echo, reads wait at most 0.1 s for the first byte
+    struct termios newtio;
+    memset(&newtio, 0, sizeof(newtio));
+    newtio.c_cflag = br | CS8 | CLOCAL | CREAD;
+    newtio.c_iflag = IGNPAR;
+    newtio.c_oflag = 0;
+    newtio.c_lflag = 0;
+    newtio.c_cc[VTIME] = 1;
+    newtio.c_cc[VMIN] = 0;
+
+    tcflush(port->fd, TCIOFLUSH);
+
+    if (tcsetattr(port->fd, TCSANOW, &newtio) == -1)
+    {
+        perror("tcsetattr");
+        close(port->fd);
+        return -1;
+    }
+    if (br == B38400 && baudRate != 38400 && setBaudRate(port->fd, baudRate) < 0)
+    {
+        tcsetattr(port->fd, TCSANOW, &port->oldtio);
+        close(port->fd);
+        return -1;
+    }
+
+    // Clear O_NONBLOCK flag to ensure blocking reads
+    oflags ^= O_NONBLOCK;
+    if (fcntl(port->fd, F_SETFL, oflags) == -1)
+    {
+        perror("fcntl");
+        close(port->fd);
+        return -1;
+    }
+
+    port->writeFd = port->fd;
+    return port->fd;
+}
+
+// Restore the original settings of a tty and close it.
+// Returns -1 on error.
+int ttyClose(SerialPort *port)
+{
+    if (tcsetattr(port->fd, TCSANOW, &port->oldtio) == -1)
+    {
+        perror("tcsetattr");
+        return -1;
+    }
+
+    return close(port->fd);
+}
+
+// Read from a tty, which waits at most 0.1 s for the first byte.
+// Returns -1 on error, otherwise the number of bytes read.
+int ttyRead(SerialPort *port, unsigned char *bytes, int numBytes)
+{
+    return read(port->fd, bytes, numBytes);
+}
+
+// Write to a tty.
+// Returns -1 on error, otherwise the number of bytes written.
+int ttyWrite(SerialPort *port, const unsigned char *bytes, int numBytes)
+{
+    return write(port->fd, bytes, numBytes);
+}
+
+const Transport ttyTransport = {"tty:", true, ttyOpen, ttyRead, ttyWrite, ttyClose};
+
+int serialOpen(SerialPort *port, const char *serialPort, int baudRate)
+{
+    const char *address;
+    port->transport = findTransport(serialPort, &address);
+    return port->transport->open(port, address, baudRate);
+}
+
+int serialClose(SerialPort *port)
+{
+    return port->transport->close(port);
+}
+
+int serialRead(SerialPort *port, unsigned char *bytes, int numBytes)
+{
+    return port->transport->read(port, bytes, numBytes);
+}
+
+int serialWrite(SerialPort *port, const unsigned char *bytes, int numBytes)
+{
+    int written = port->transport->write(port, bytes, numBytes);
+    if (written > 0)
+    {
+        port->bytesWritten += written;
+    }
+    return written;
+}
@@ -0,0 +1,372 @@
+// Shared memory transport implementation
+
+#include "shm_transport.h"
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+    ShmRegion *region;
+    ShmRing *in;
+    ShmRing *out;
+    int bell; // our own doorbell, rung when bytes are left in the ring after a read
+
+    // a written byte gets a bit error when the PRNG draws below errorThreshold
+    uint64_t errorThreshold;
+    uint64_t random;
+} ShmEnd;
+
+// Current monotonic time, in nanoseconds.
+uint64_t shmNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Scramble a seed with splitmix64, so that small seeds do not start xorshift64 on small numbers; those
+// would fall below the error threshold on the first bytes written.
+uint64_t shmScramble(uint64_t seed)
+{
+    seed += 0x9E3779B97F4A7C15;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EB;
+    seed ^= seed >> 31;
+    // xorshift64 must not start at 0
+    return seed != 0 ? seed : 1;
+}
+
+// Next number of the xorshift64 PRNG.
+uint64_t shmRandom(ShmEnd *end)
+{
+    end->random ^= end->random << 13;
+    end->random ^= end->random >> 7;
+    end->random ^= end->random << 17;
+    return end->random;
+}
+
+// Wake a reader up, if its doorbell is not already ringing. The doorbell of an end that is gone is left alone.
+void ringBell(int fd)
+{
+    char bell = 0;
+    if (pipeWrite(fd, &bell, 1) < 0 && errno != EAGAIN && errno != EPIPE)
+    {
+        perror("shm doorbell");
+    }
+}
+
+// Open the doorbell of side in, read by this end, and the one of side out, rung by it, like a pipe pair.
+// Returns -1 on error.
+int openBells(SerialPort *port, ShmEnd *end, const char *name, int side)
+{
+    char in[128], out[128];
+    snprintf(in, sizeof(in), "/tmp/ll-%s.bell%d", name, side);
+    snprintf(out, sizeof(out), "/tmp/ll-%s.bell%d", name, 1 - side);
+    if ((mkfifo(in, 0600) < 0 && errno != EEXIST) || (mkfifo(out, 0600) < 0 && errno != EEXIST))
+    {
+        perror("mkfifo");
+        return -1;
+    }
+    // read and written, to ring it after a read that left bytes behind; the closed flag of the ring, not
+    // the end of the pipe, tells that the other end is gone
+    port->fd = open(in, O_RDWR | O_NONBLOCK);
+    if (port->fd < 0)
+    {
+        perror(in);
+        return -1;
+    }
+    end->bell = port->fd;
+    // waits for the other end to open its doorbell, which is then no longer needed by name
+    port->writeFd = open(out, O_WRONLY);
+    if (port->writeFd < 0 || fcntl(port->writeFd, F_SETFL, O_NONBLOCK) < 0)
+    {
+        perror(out);
+        if (port->writeFd >= 0)
+        {
+            close(port->writeFd);
+        }
+        close(port->fd);
+        return -1;
+    }
+    unlink(out);
+    return 0;
+}
+
+// Open shm:<name>[,ber=<p>][,delay=<ms>][,seed=<n>].
+// Returns the file descriptor of the doorbell, or -1 on error.
+int shmOpen(SerialPort *port, const char *address, int baudRate)
+{
+    (void)baudRate;
+    char name[64];
+    int length = strcspn(address, ",");
+    if (length == 0 || length >= (int)sizeof(name) || memchr(address, '/', length) != NULL)
+    {
+        fprintf(stderr, "Shared memory is named shm:<name>[,ber=<p>][,delay=<ms>][,seed=<n>]\n");
+        return -1;
+    }
+    memcpy(name, address, length);
+    name[length] = '\0';
+
+    double ber = 0, delay = 0;
+    unsigned long seed = 1;
+    for (const char *option = address + length; *option == ','; option += strcspn(option + 1, ",") + 1)
+    {
+        if (strncmp(option, ",ber=", 5) == 0)
+        {
+            ber = strtod(option + 5, NULL);
+        }
+        else if (strncmp(option, ",delay=", 7) == 0)
+        {
+            delay = strtod(option + 7, NULL);
+        }
+        else if (strncmp(option, ",seed=", 6) == 0)
+        {
+            seed = strtoul(option + 6, NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown shared memory option %s\n", option + 1);
+            return -1;
+        }
+    }
+
+    char shmName[72];
+    snprintf(shmName, sizeof(shmName), "/ll-%s", name);
+    int fd = shm_open(shmName, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(ShmRegion)) < 0)
+    {
+        perror(shmName);
+        return -1;
+    }
+    ShmRegion *region = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    int side = atomic_fetch_add(&region->ends, 1);
+    if (side > 1)
+    {
+        fprintf(stderr, "%s already has both ends, remove /dev/shm%s if a run crashed\n", shmName, shmName);
+        munmap(region, sizeof(ShmRegion));
+        return -1;
+    }
+    // the next run gets a region of its own
+    if (side == 1)
+    {
+        shm_unlink(shmName);
+    }
+
+    ShmEnd *end = calloc(1, sizeof(ShmEnd));
+    if (end == NULL)
+    {
+        munmap(region, sizeof(ShmRegion));
+        return -1;
+    }
+    end->region = region;
+    end->out = &region->rings[side];
+    end->in = &region->rings[1 - side];
+    end->out->delay = delay * 1000000;
+    // a byte of 8 bits is hit unless all of them are spared
+    double spared = 1;
+    for (int i = 0; i < 8; i++)
+    {
+        spared *= 1 - ber;
+    }
+    // once 1 - spared rounds to 1 the threshold is 2^64, which does not fit, and every byte is hit anyway
+    double threshold = (1 - spared) * 18446744073709551616.0;
+    end->errorThreshold = threshold >= 18446744073709551616.0 ? UINT64_MAX : (uint64_t)threshold;
+    end->random = shmScramble(seed * 2 + side);
+    port->state = end;
+    if (openBells(port, end, name, side) < 0)
+    {
+        // the other end, if any, reads the ring as closed instead of waiting on it, and the next run gets a
+        // region of its own
+        atomic_store(&end->out->closed, 1);
+        if (side == 0)
+        {
+            shm_unlink(shmName);
+        }
+        munmap(region, sizeof(ShmRegion));
+        free(end);
+        port->state = NULL;
+        return -1;
+    }
+    return port->fd;
+}
+
+// Copy the ring bytes from position start on, count of them, to bytes.
+void ringCopyOut(const ShmRing *ring, uint32_t start, unsigned char *bytes, int count)
+{
+    int index = start % SHM_RING_SIZE;
+    int first = count < SHM_RING_SIZE - index ? count : SHM_RING_SIZE - index;
+    memcpy(bytes, ring->data + index, first);
+    memcpy(bytes + first, ring->data, count - first);
+}
+
+// Read what the other end wrote and is due, waiting for the oldest delayed bytes to be due if that is all
+// there is.
+// Returns -1 once the ring is empty and the other end closed, or once this end is closed, otherwise the
+// number of bytes read.
+int shmRead(SerialPort *port, unsigned char *bytes, int numBytes)
+{
+    ShmEnd *end = port->state;
+    if (end == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    ShmRing *ring = end->in;
+    // silence the doorbell before looking at the ring, a write after that rings it again
+    char bells[64];
+    while (read(port->fd, bells, sizeof(bells)) > 0)
+    {
+    }
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t limit = atomic_load(&ring->head);
+    if (limit == tail && atomic_load(&ring->closed))
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    if (ring->delay > 0)
+    {
+        // up to the end of the newest write that is due
+        uint32_t markTail = atomic_load_explicit(&ring->markTail, memory_order_relaxed);
+        uint32_t markHead = atomic_load_explicit(&ring->markHead, memory_order_acquire);
+        uint64_t now = shmNow();
+        limit = tail;
+        for (uint32_t mark = markTail; mark != markHead; mark++)
+        {
+            const ShmMark *pending = &ring->marks[mark % SHM_MARKS];
+            if (pending->dueAt > now && mark == markTail)
+            {
+                struct timespec wait = {0, pending->dueAt - now};
+                wait.tv_sec = wait.tv_nsec / 1000000000;
+                wait.tv_nsec %= 1000000000;
+                nanosleep(&wait, NULL);
+                now = pending->dueAt;
+            }
+            else if (pending->dueAt > now)
+            {
+                break;
+            }
+            limit = pending->end;
+        }
+    }
+
+    int count = limit - tail < (uint32_t)numBytes ? (int)(limit - tail) : numBytes;
+    ringCopyOut(ring, tail, bytes, count);
+    tail += count;
+    atomic_store(&ring->tail, tail);
+    if (ring->delay > 0)
+    {
+        uint32_t markTail = atomic_load_explicit(&ring->markTail, memory_order_relaxed);
+        while (markTail != atomic_load_explicit(&ring->markHead, memory_order_acquire) &&
+               (int32_t)(ring->marks[markTail % SHM_MARKS].end - tail) <= 0)
+        {
+            markTail++;
+        }
+        atomic_store_explicit(&ring->markTail, markTail, memory_order_release);
+    }
+    // bytes left behind must wake the next poll up, as the doorbell was silenced
+    if (atomic_load(&ring->head) != tail)
+    {
+        ringBell(end->bell);
+    }
+    return count;
+}
+
+// Write all bytes to the ring of the other end, waiting for room while it is full, with bit errors if asked.
+// Returns -1 once this end is closed, otherwise the number of bytes written.
+int shmWrite(SerialPort *port, const unsigned char *bytes, int numBytes)
+{
+    ShmEnd *end = port->state;
+    if (end == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    ShmRing *ring = end->out;
+    int written = 0;
+    while (written < numBytes)
+    {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t markHead = atomic_load_explicit(&ring->markHead, memory_order_relaxed);
+        int room = SHM_RING_SIZE - (head - atomic_load_explicit(&ring->tail, memory_order_acquire));
+        if (ring->delay > 0 && markHead - atomic_load_explicit(&ring->markTail, memory_order_acquire) == SHM_MARKS)
+        {
+            room = 0;
+        }
+        if (room == 0)
+        {
+            ringBell(port->writeFd);
+            sched_yield();
+            continue;
+        }
+
+        int count = numBytes - written < room ? numBytes - written : room;
+        int index = head % SHM_RING_SIZE;
+        int first = count < SHM_RING_SIZE - index ? count : SHM_RING_SIZE - index;
+        memcpy(ring->data + index, bytes + written, first);
+        memcpy(ring->data, bytes + written + first, count - first);
+        for (int i = 0; end->errorThreshold > 0 && i < count; i++)
+        {
+            // the draw that hit is below the threshold, so its top bits are zeros; the bit comes from the next one
+            if (shmRandom(end) < end->errorThreshold)
+            {
+                ring->data[(head + i) % SHM_RING_SIZE] ^= 1 << (shmRandom(end) >> 61);
+            }
+        }
+        written += count;
+        if (ring->delay > 0)
+        {
+            ShmMark *mark = &ring->marks[markHead % SHM_MARKS];
+            mark->dueAt = shmNow() + ring->delay;
+            mark->end = head + count;
+            atomic_store_explicit(&ring->markHead, markHead + 1, memory_order_release);
+        }
+        atomic_store(&ring->head, head + count);
+        // a reader that drained the ring before these bytes may be asleep
+        if (atomic_load(&ring->tail) == head)
+        {
+            ringBell(port->writeFd);
+        }
+    }
+    return written;
+}
+
+// Tell the other end that no more bytes will come, and release the region.
+// Returns -1 on error.
+int shmClose(SerialPort *port)
+{
+    ShmEnd *end = port->state;
+    // like a closed fd: llwrite closes the link when it gives up, and the application closes it again
+    if (end == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    atomic_store(&end->out->closed, 1);
+    ringBell(port->writeFd);
+    close(port->writeFd);
+    int status = close(port->fd);
+    munmap(end->region, sizeof(ShmRegion));
+    free(end);
+    port->state = NULL;
+    return status;
+}
+
+const Transport shmTransport = {"shm:", false, shmOpen, shmRead, shmWrite, shmClose};
@@ -0,0 +1,123 @@
+// Byte stuffing implementation
+
+#include "stuffing.h"
+#include "frame.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STUFFING_SIMD 1
+#endif
+
+// bytes copied between two folds into the frame check sequence, small enough to still be in cache
+#define FOLD_BLOCK 512
+
+pthread_once_t stuffingOnce = PTHREAD_ONCE_INIT;
+bool haveAvx2 = false;
+
+int findSpecialScalar(const unsigned char *data, int size)
+{
+    int i = 0;
+    while (i < size && data[i] != FLAG && data[i] != ESC)
+    {
+        i++;
+    }
+    return i;
+}
+
+#ifdef STUFFING_SIMD
+__attribute__((target("sse2")))
+int findSpecialSse2(const unsigned char *data, int size)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG);
+    const __m128i esc = _mm_set1_epi8(ESC);
+    int i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, flag), _mm_cmpeq_epi8(block, esc)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + findSpecialScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+int findSpecialAvx2(const unsigned char *data, int size)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG);
+    const __m256i esc = _mm256_set1_epi8(ESC);
+    int i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, flag), _mm256_cmpeq_epi8(block, esc)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    // the tail stays in AVX code, calling the SSE2 kernel would pay an SSE/AVX transition
+    for (; i < size; i++)
+    {
+        if (data[i] == FLAG || data[i] == ESC)
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+void detectCpu()
+{
+    __builtin_cpu_init();
+    haveAvx2 = __builtin_cpu_supports("avx2");
+}
+#endif
+
+int findSpecial(const unsigned char *data, int size)
+{
+#ifdef STUFFING_SIMD
+    pthread_once(&stuffingOnce, detectCpu);
+    return haveAvx2 ? findSpecialAvx2(data, size) : findSpecialSse2(data, size);
+#else
+    return findSpecialScalar(data, size);
+#endif
+}
+
+int stuffBytes(unsigned char *out, const unsigned char *data, int size, FcsType type, uint32_t *fcs, int *escapes)
+{
+    int written = 0;
+    int escaped = 0;
+    int folded = 0;
+    int i = 0;
+    while (i < size)
+    {
+        // escape FLAG and ESC bytes in place, then copy the clean run after them
+        while (i < size && (data[i] == FLAG || data[i] == ESC))
+        {
+            out[written++] = ESC;
+            out[written++] = data[i++] ^ 0x20;
+            escaped++;
+        }
+        if (i < size)
+        {
+            int run = findSpecial(data + i, size - i);
+            memcpy(out + written, data + i, run);
+            written += run;
+            i += run;
+        }
+
+        if (fcs != NULL && (i - folded >= FOLD_BLOCK || i == size))
+        {
+            *fcs = fcsUpdate(type, *fcs, data + folded, i - folded);
+            folded = i;
+        }
+    }
+    *escapes += escaped;
+    return written;
+}
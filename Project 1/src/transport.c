@@ -0,0 +1,295 @@
+// Transport implementation
+
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Socket pairs opened once and waiting for their second end.
+#define MAX_SOCKET_PAIRS 8
+// How long the two ends of a TCP connection keep trying to meet, in 10 ms steps.
+#define TCP_OPEN_TRIES 500
+
+////////////////////////////////////////////////
+// STREAMS
+////////////////////////////////////////////////
+
+// Read from a pipe or socket. Unlike a tty, which reads nothing once the cable is pulled, the end of
+// the stream means that the other end closed it for good.
+// Returns -1 on error or at the end of the stream, otherwise the number of bytes read.
+int streamRead(SerialPort *port, unsigned char *bytes, int numBytes)
+{
+    int bytesRead = read(port->fd, bytes, numBytes);
+    if (bytesRead == 0 && numBytes > 0)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    return bytesRead;
+}
+
+// Write to a pipe or FIFO with SIGPIPE blocked in this thread, so that once the other end is closed the
+// write fails with EPIPE instead of ending the process. The SIGPIPE it raised is taken off again, unless
+// one was already pending, and the signal mask restored.
+// Returns -1 on error, otherwise the number of bytes written.
+int pipeWrite(int fd, const void *bytes, int numBytes)
+{
+    sigset_t pipeSignal;
+    sigset_t oldMask;
+    sigset_t pending;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    sigpending(&pending);
+    bool wasPending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+
+    int written = write(fd, bytes, numBytes);
+    if (written < 0 && errno == EPIPE && !wasPending)
+    {
+        const struct timespec now = {0, 0};
+        while (sigtimedwait(&pipeSignal, NULL, &now) < 0 && errno == EINTR)
+        {
+        }
+        errno = EPIPE;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    return written;
+}
+
+// Write to a pipe.
+// Returns -1 on error, otherwise the number of bytes written.
+int streamWrite(SerialPort *port, const unsigned char *bytes, int numBytes)
+{
+    return pipeWrite(port->writeFd, bytes, numBytes);
+}
+
+// Close both ends of a pipe pair or a socket.
+// Returns -1 on error.
+int streamClose(SerialPort *port)
+{
+    int status = port->writeFd != port->fd ? close(port->writeFd) : 0;
+    return close(port->fd) < 0 ? -1 : status;
+}
+
+////////////////////////////////////////////////
+// PIPE PAIR
+////////////////////////////////////////////////
+
+// Open the pipes of pipe:<out>,<in>, creating them if needed.
+// Returns the file descriptor to read from, or -1 on error.
+int pipeOpen(SerialPort *port, const char *address, int baudRate)
+{
+    (void)baudRate;
+    const char *comma = strchr(address, ',');
+    char out[256];
+    if (comma == NULL || comma - address >= (int)sizeof(out))
+    {
+        fprintf(stderr, "A pipe pair is named pipe:<out>,<in>\n");
+        return -1;
+    }
+    memcpy(out, address, comma - address);
+    out[comma - address] = '\0';
+    const char *in = comma + 1;
+    if ((mkfifo(out, 0600) < 0 && errno != EEXIST) || (mkfifo(in, 0600) < 0 && errno != EEXIST))
+    {
+        perror("mkfifo");
+        return -1;
+    }
+
+    // opening the read end does not wait for a writer, so both ends can then open their write end, which
+    // waits for the reader of the other end
+    port->fd = open(in, O_RDONLY | O_NONBLOCK);
+    if (port->fd < 0)
+    {
+        perror(in);
+        return -1;
+    }
+    port->writeFd = open(out, O_WRONLY);
+    if (port->writeFd < 0 || fcntl(port->fd, F_SETFL, 0) < 0)
+    {
+        perror(out);
+        close(port->fd);
+        return -1;
+    }
+    return port->fd;
+}
+
+const Transport pipeTransport = {"pipe:", false, pipeOpen, streamRead, streamWrite, streamClose};
+
+////////////////////////////////////////////////
+// SOCKET PAIR
+////////////////////////////////////////////////
+
+typedef struct
+{
+    char name[64];
+    int fd; // end left for the second port opened with the name
+} PendingPair;
+
+PendingPair pendingPairs[MAX_SOCKET_PAIRS];
+int pendingPairCount = 0;
+pthread_mutex_t pendingPairLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Open one end of socketpair:<name>: the first port opened with a name creates the pair, the second one
+// takes its other end.
+// Returns the file descriptor, or -1 on error.
+int socketPairOpen(SerialPort *port, const char *address, int baudRate)
+{
+    (void)baudRate;
+    if (strlen(address) >= sizeof(pendingPairs[0].name))
+    {
+        fprintf(stderr, "Socket pair name too long\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&pendingPairLock);
+    port->fd = -1;
+    for (int i = 0; i < pendingPairCount; i++)
+    {
+        if (strcmp(pendingPairs[i].name, address) == 0)
+        {
+            port->fd = pendingPairs[i].fd;
+            pendingPairs[i] = pendingPairs[--pendingPairCount];
+            break;
+        }
+    }
+    if (port->fd < 0)
+    {
+        int fds[2];
+        if (pendingPairCount == MAX_SOCKET_PAIRS || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            pthread_mutex_unlock(&pendingPairLock);
+            perror("socketpair");
+            return -1;
+        }
+        strcpy(pendingPairs[pendingPairCount].name, address);
+        pendingPairs[pendingPairCount].fd = fds[1];
+        pendingPairCount++;
+        port->fd = fds[0];
+    }
+    pthread_mutex_unlock(&pendingPairLock);
+
+    port->writeFd = port->fd;
+    return port->fd;
+}
+
+// Write to a socket, failing with EPIPE instead of ending the process once the other end is closed.
+// Returns -1 on error, otherwise the number of bytes written.
+int socketWrite(SerialPort *port, const unsigned char *bytes, int numBytes)
+{
+    return send(port->writeFd, bytes, numBytes, MSG_NOSIGNAL);
+}
+
+const Transport socketPairTransport = {"socketpair:", false, socketPairOpen, streamRead, socketWrite, streamClose};
+
+////////////////////////////////////////////////
+// TCP
+////////////////////////////////////////////////
+
+// Open tcp:<host>:<port>: connect to the other end, or, if it is not listening yet, listen for it.
+// Returns the file descriptor, or -1 on error.
+int tcpOpen(SerialPort *port, const char *address, int baudRate)
+{
+    (void)baudRate;
+    const char *colon = strrchr(address, ':');
+    char host[256];
+    if (colon == NULL || colon - address >= (int)sizeof(host))
+    {
+        fprintf(stderr, "A TCP port is named tcp:<host>:<port>\n");
+        return -1;
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *info;
+    int error = getaddrinfo(host, colon + 1, &hints, &info);
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    port->fd = -1;
+    for (int tries = 0; port->fd < 0 && tries < TCP_OPEN_TRIES; tries++)
+    {
+        int fd = socket(info->ai_family, info->ai_socktype, 0);
+        if (fd < 0)
+        {
+            break;
+        }
+        if (connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+        {
+            port->fd = fd;
+            break;
+        }
+        close(fd);
+
+        // nobody listens yet, so this end does, unless the other end got there first
+        int listener = socket(info->ai_family, info->ai_socktype, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(listener, info->ai_addr, info->ai_addrlen) == 0 && listen(listener, 1) == 0)
+        {
+            port->fd = accept(listener, NULL, NULL);
+        }
+        else if (errno != EADDRINUSE)
+        {
+            close(listener);
+            break;
+        }
+        close(listener);
+        if (port->fd < 0)
+        {
+            usleep(10000);
+        }
+    }
+    freeaddrinfo(info);
+    if (port->fd < 0)
+    {
+        perror(address);
+        return -1;
+    }
+
+    // frames must leave at once, not wait to be merged with the next ones
+    int noDelay = 1;
+    setsockopt(port->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    port->writeFd = port->fd;
+    return port->fd;
+}
+
+const Transport tcpTransport = {"tcp:", false, tcpOpen, streamRead, socketWrite, streamClose};
+
+////////////////////////////////////////////////
+// LOOKUP
+////////////////////////////////////////////////
+
+const Transport *findTransport(const char *name, const char **address)
+{
+    const Transport *transports[] = {&ttyTransport, &pipeTransport, &socketPairTransport, &tcpTransport,
+                                     &shmTransport};
+    for (int i = 0; i < (int)(sizeof(transports) / sizeof(transports[0])); i++)
+    {
+        int length = strlen(transports[i]->prefix);
+        if (strncmp(name, transports[i]->prefix, length) == 0)
+        {
+            *address = name + length;
+            return transports[i];
+        }
+    }
+    *address = name;
+    return &ttyTransport;
+}